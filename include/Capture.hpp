@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Ipc {
+
+    // On-disk record header. Followed by size bytes of payload, padded so
+    // the next header starts on an 8 byte boundary.
+    struct CaptureRecord {
+        enum Direction : uint8_t {
+            Sent = 0,
+            Received = 1,
+        };
+
+        uint64_t timestamp;                 // CLOCK_MONOTONIC, nanoseconds
+        uint64_t connectionId;
+        uint32_t size;
+        uint8_t direction;
+        uint8_t reserved[3];
+    };
+
+    struct CaptureOptions {
+        size_t segmentSize = 64 * 1024 * 1024;
+        size_t ringSize = 1024 * 1024;      // per recording thread
+        unsigned flushIntervalMs = 10;
+    };
+
+    // Process wide traffic capture. While active, every message sent or
+    // received through a Connection is copied into a ring owned by the
+    // calling thread; a background thread merges the rings by timestamp
+    // into memory-mapped log segments named <path>.0000, <path>.0001, ...
+    // Records that reach the writer late can land slightly out of
+    // timestamp order, so readers that care should sort.
+    class Capture {
+        public:
+            struct Stats {
+                uint64_t recorded;
+                uint64_t dropped;           // ring full or message too large
+                uint64_t bytesWritten;
+                uint64_t segments;
+            };
+
+            static bool start(const std::string &path, const CaptureOptions &options = CaptureOptions());
+            static void stop();
+            static Stats getStats();
+
+            static bool isActive()
+            {
+                return active.load(std::memory_order_relaxed);
+            }
+
+            static void record(uint64_t connectionId, CaptureRecord::Direction direction,
+                               const char *data, size_t size);
+
+        private:
+            static std::atomic<bool> active;
+    };
+
+    // Reads back the records of a capture in the order they were written
+    class CaptureReader {
+        public:
+            CaptureReader(const std::string &path);
+            ~CaptureReader();
+
+            // Copying not allowed
+            CaptureReader(CaptureReader const &) = delete;
+            CaptureReader& operator=(CaptureReader const &) = delete;
+
+            bool next(CaptureRecord &record, std::vector<char> &payload);
+
+        private:
+            bool openSegment();
+            void closeSegment();
+
+            std::string path;
+            unsigned segment;
+            const char *data;
+            size_t size;
+            size_t offset;
+    };
+
+}; // namespace Ipc
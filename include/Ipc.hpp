@@ -24,17 +24,131 @@
 
 #pragma once
 
+#include <cstddef>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #include <windows.h>
+#elif defined(__linux) || defined(__linux__) || defined(linux)
+#include <sys/socket.h>
+#include <sys/un.h>
 #endif
 
 namespace Ipc {
 
+    // Socket buffer autotuning. When enabled, every connection periodically
+    // samples its send queue occupancy and doubles its send buffer when the
+    // queue runs full or halves it when the queue stays mostly empty. Sizes
+    // are the values reported by the kernel. The sum of all connection send
+    // buffers is kept below processLimit: growth beyond it is refused, and
+    // connections opened once it is used up start at minSize (each of those
+    // may overshoot the limit by that much). Unix sockets charge queued
+    // messages to the sender only, so receive buffers are left alone.
+    //
+    // Decisions are only made from send/recv and explicit tune() calls.
+    // Connections aren't thread safe, so nothing samples them in the
+    // background; call tune() on idle connections to let them shrink.
+    struct BufferTuning {
+        bool enabled = false;
+        size_t initialSize = 0;             // 0 keeps the kernel default
+        size_t minSize = 16 * 1024;
+        size_t maxSize = 4 * 1024 * 1024;
+        size_t processLimit = 64 * 1024 * 1024;
+        unsigned sampleInterval = 64;       // send/recv calls between samples
+    };
+
+    void setBufferTuning(const BufferTuning &tuning);
+    BufferTuning getBufferTuning();
+
+    // Socket buffer bytes currently accounted against processLimit
+    size_t getBufferMemory();
+
+    // Client side response cache for idempotent sendrecv() calls, keyed by
+    // the request bytes. Servers push invalidations through a
+    // CacheInvalidator; while the client can't reach one, cached answers
+    // are not served for longer than maxStalenessMs.
+    struct CacheOptions {
+        size_t maxBytes = 1024 * 1024;      // keys, replies and bookkeeping
+        unsigned ttlMs = 60 * 1000;
+        unsigned maxStalenessMs = 100;
+    };
+
+    struct CacheStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t expirations;
+        uint64_t invalidations;
+        uint64_t evictions;
+        size_t entries;
+        size_t bytes;
+        double hitRatio;
+        bool subscribed;                    // invalidation channel connected
+    };
+
+    class ResponseCache;
+
+    // Where a Server listens and Clients connect. The socket addresses are
+    // built once, here. Filesystem endpoints live under /tmp; abstract
+    // endpoints (Linux only) need no file and no cleanup. An endpoint may
+    // have several redundant listeners, which clients take turns
+    // connecting to.
+    class Endpoint {
+        public:
+            enum Namespace {
+                Filesystem,
+                Abstract,
+            };
+
+            Endpoint(std::string name, Namespace space = Filesystem, unsigned listeners = 1);
+
+            const std::string &getName() const;
+            Namespace getNamespace() const;
+            unsigned getListenerCount() const;
+
+            // True when the name doesn't fit in a socket address
+            bool isInvalid() const;
+
+            // An endpoint in the same namespace, for side channels
+            Endpoint getChannel(const std::string &suffix) const;
+
+        private:
+            std::string name;
+            Namespace space;
+            unsigned listeners;
+#if defined(__linux) || defined(__linux__) || defined(linux)
+            struct Address {
+                struct sockaddr_un addr;
+                socklen_t len;
+            };
+
+            std::vector<Address> addresses;
+#endif
+            friend class Server;
+            friend class Client;
+            friend class CacheInvalidator;
+            friend class ResponseCache;
+    };
+
     class Connection {
         public:
+            struct Stats {
+                size_t sendBufferSize;
+                size_t recvBufferSize;      // reported only, never tuned
+                size_t peakSendQueue;
+                size_t peakRecvQueue;
+                uint64_t messagesSent;
+                uint64_t messagesReceived;
+                uint64_t bytesSent;
+                uint64_t bytesReceived;
+                uint64_t bufferGrows;
+                uint64_t bufferShrinks;
+                uint64_t bufferDenied;      // grows refused by processLimit
+            };
+
             ~Connection();
 
             // Copying not allowed
@@ -42,8 +156,8 @@ namespace Ipc {
             Connection& operator=(Connection const &) = delete;
 
             // Moving is allowed
-            Connection(Connection &&) = default;
-            Connection& operator=(Connection &&) = default;
+            Connection(Connection &&other);
+            Connection& operator=(Connection &&other);
 
             bool send(const char *src, size_t srcSize, size_t *bytesSent = NULL);
             bool recv(char *dst, size_t dstSize, size_t *bytesReceived = NULL);
@@ -51,16 +165,57 @@ namespace Ipc {
                       size_t *bytesReceived = NULL, size_t *bytesAvailable = NULL);
             bool isInvalid();
 
+            // True when the last message received didn't fit in the buffer
+            // given to recv(); the rest of that message was discarded
+            bool isTruncated();
+
+            // Process unique identifier, used to tag captured traffic
+            uint64_t getId();
+
+            // Sample queue occupancy and resize buffers now. Called
+            // automatically from send/recv; call it periodically on idle
+            // connections to let their buffers shrink.
+            void tune();
+            Stats getStats();
+
         private:
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
             Connection(HANDLE inPipe);
             HANDLE inPipe;
 #elif defined(__linux) || defined(__linux__) || defined(linux)
+            // Per connection state of a sampled request awaiting its reply
+            struct TraceState {
+                bool timestamping;
+                bool requester;             // made by Client::connect()
+                bool pending;
+                uint32_t id;
+                uint64_t sendTime;
+                uint32_t requestTransit;
+                uint32_t requestWakeup;
+                uint64_t receiveTime;
+            };
+
             Connection(int connfd);
+            void enableTimestamps();
+            bool sendTraced(const char *src, size_t srcSize, size_t *sent);
+            bool recvTraced(char *dst, size_t dstSize, int flags, size_t *received,
+                            bool *hasHeader = NULL);
+            void initBuffers();
+            void releaseBuffers();
+            size_t applySendBuffer(size_t accounted);
+            bool resizeSendBuffer(size_t newSize);
+            void sampleSendQueue();
             int connfd;
+            bool buffersAccounted = false;
+            unsigned opsSinceTune = 0;
+            size_t windowSendQueue = 0;     // peak since the last decision
+            TraceState trace = {};
 #else
             Connection();
 #endif
+            uint64_t id = 0;
+            Stats stats = {};
+            bool truncated = false;
             friend class Server;
             friend class Client;
     };
@@ -73,31 +228,80 @@ namespace Ipc {
             Server(Server const &) = delete;
             Server& operator=(Server const &) = delete;
 
-            void init(std::string name);
+            // backlog bounds the connections waiting for accept() on each
+            // listener; further connects block until there's room
+            void init(std::string name, int backlog = 5);
+            void init(const Endpoint &endpoint, int backlog = 5);
+
+            // Waits on all listeners of the endpoint
             Connection accept();
 
         private:
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
             HANDLE inPipe;
 #elif defined(__linux) || defined(__linux__) || defined(linux)
+            std::vector<int> listenfds;
+            unsigned nextListener = 0;
+#endif
+    };
+
+    // Publishes cache invalidations to the clients of a server. Not thread
+    // safe; serialize calls when publishing from several threads.
+    class CacheInvalidator {
+        public:
+            CacheInvalidator();
+            ~CacheInvalidator();
+
+            // Copying not allowed
+            CacheInvalidator(CacheInvalidator const &) = delete;
+            CacheInvalidator& operator=(CacheInvalidator const &) = delete;
+
+            // Uses the same name as the Server whose answers get cached
+            void init(std::string name);
+            void init(const Endpoint &endpoint);
+
+            // Drop the cached reply to this request from every client. Once
+            // this returns, no client serves the old reply again.
+            void invalidate(const char *request, size_t requestSize);
+            void invalidateAll();
+            size_t getSubscriberCount();
+
+        private:
+            void publish(char op, const char *request, size_t requestSize);
+#if defined(__linux) || defined(__linux__) || defined(linux)
             int listenfd;
+            std::vector<int> subscribers;
 #endif
     };
 
     class Client {
         public:
             Client(std::string name);
+            Client(const Endpoint &endpoint);
+            ~Client();
 
             // Copying not allowed
             Client(Client const &) = delete;
             Client& operator=(Client const &) = delete;
 
+            // useCache = false sends the request past the cache, for
+            // requests that change state or whose reply may differ
             bool sendrecv(char *dst, size_t dstSize, const char *src, size_t srcSize,
-                          size_t *bytesReceived = NULL);
+                          size_t *bytesReceived = NULL, bool useCache = true);
             Connection connect();
 
+            // Cache sendrecv() replies. Only for requests whose reply
+            // depends on nothing but the request bytes; pass useCache =
+            // false to sendrecv() for all others. Empty and truncated
+            // replies are never cached.
+            void enableCache(const CacheOptions &options = CacheOptions());
+            void disableCache();
+            CacheStats getCacheStats();
+
         private:
-            std::string name;
+            Endpoint endpoint;
+            std::atomic<unsigned> nextListener;
+            std::unique_ptr<ResponseCache> cache;
     };
 
 }; // namespace Ipc
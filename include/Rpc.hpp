@@ -0,0 +1,263 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#include "Ipc.hpp"
+
+namespace Ipc {
+
+    enum RpcStatus : uint32_t {
+        RpcOk = 0,
+        RpcUnknownMethod = 1,
+        RpcBadRequest = 2,
+        RpcFailed = 3,
+    };
+
+    // Every request and reply message starts with this header. The request
+    // or reply structure follows immediately, 8 byte aligned.
+    struct alignas(8) RpcHeader {
+        uint32_t method;
+        uint32_t status;
+    };
+
+    // Binds a method ID to a handler. Requests and replies are plain
+    // structures that are used directly from the message buffers, so they
+    // must be trivially copyable.
+    template <uint32_t Id, typename RequestType, typename ReplyType,
+              bool (*Handler)(const RequestType &, ReplyType &)>
+    struct RpcMethod {
+        static_assert(std::is_trivially_copyable<RequestType>::value,
+                      "RPC requests must be trivially copyable");
+        static_assert(std::is_trivially_copyable<ReplyType>::value,
+                      "RPC replies must be trivially copyable");
+        static_assert(alignof(RequestType) <= alignof(RpcHeader) &&
+                      alignof(ReplyType) <= alignof(RpcHeader),
+                      "RPC structures can't be aligned stricter than RpcHeader");
+
+        typedef RequestType Request;
+        typedef ReplyType Reply;
+        static const uint32_t id = Id;
+
+        // Decodes the request in place and builds the reply directly in
+        // the reply buffer
+        static RpcStatus invoke(const char *request, size_t requestSize,
+                                char *reply, size_t *replySize)
+        {
+            if (requestSize != sizeof(Request)) return RpcBadRequest;
+
+            const Request &req = *reinterpret_cast<const Request *>(request);
+            Reply &rep = *new (reply) Reply();
+            if (!Handler(req, rep)) return RpcFailed;
+
+            *replySize = sizeof(Reply);
+            return RpcOk;
+        }
+    };
+
+    namespace detail {
+        constexpr size_t rpcMax()
+        {
+            return 0;
+        }
+
+        template <typename... Sizes>
+        constexpr size_t rpcMax(size_t first, Sizes... rest)
+        {
+            return first > rpcMax(rest...) ? first : rpcMax(rest...);
+        }
+
+        template <size_t N>
+        constexpr bool rpcUniqueIds(const uint32_t (&ids)[N])
+        {
+            for (size_t i = 0; i < N; i++)
+                for (size_t j = i + 1; j < N; j++)
+                    if (ids[i] == ids[j]) return false;
+            return true;
+        }
+    };
+
+    // Serves RpcMethods over Connections. The method table is fixed at
+    // compile time; serve() keeps its buffers on the stack and its counters
+    // are atomic, so a single dispatcher can be shared by any number of
+    // threads serving different connections.
+    template <typename... Methods>
+    class RpcDispatcher {
+        static_assert(sizeof...(Methods) > 0, "RpcDispatcher needs at least one method");
+
+        public:
+            static const size_t methodCount = sizeof...(Methods);
+            static const size_t bufferSize = sizeof(RpcHeader) +
+                detail::rpcMax(sizeof(typename Methods::Request)...,
+                               sizeof(typename Methods::Reply)...);
+
+            struct MethodStats {
+                uint32_t id;
+                uint64_t calls;
+                uint64_t failures;
+                uint64_t totalNs;
+                uint64_t maxNs;
+            };
+
+            RpcDispatcher() { }
+
+            // Copying not allowed
+            RpcDispatcher(RpcDispatcher const &) = delete;
+            RpcDispatcher& operator=(RpcDispatcher const &) = delete;
+
+            // Receive one request, run its handler and send the reply.
+            // Returns false once the connection fails or is closed.
+            bool serve(Connection &connection)
+            {
+                alignas(RpcHeader) char request[bufferSize];
+                alignas(RpcHeader) char reply[bufferSize];
+                size_t received = 0;
+
+                if (!connection.recv(request, bufferSize, &received) || received == 0)
+                    return false;
+
+                RpcHeader *replyHeader = new (reply) RpcHeader();
+                size_t replySize = 0;
+
+                // A request longer than any method's could otherwise pass
+                // the size check of a method with a shorter request
+                if (received < sizeof(RpcHeader) || connection.isTruncated()) {
+                    replyHeader->status = RpcBadRequest;
+                }
+                else {
+                    const RpcHeader *header = reinterpret_cast<const RpcHeader *>(request);
+                    replyHeader->method = header->method;
+                    replyHeader->status = dispatch(header->method,
+                                                   request + sizeof(RpcHeader),
+                                                   received - sizeof(RpcHeader),
+                                                   reply + sizeof(RpcHeader),
+                                                   &replySize);
+                }
+
+                return connection.send(reply, sizeof(RpcHeader) + replySize);
+            }
+
+            // Serve requests until the connection is closed
+            void serveAll(Connection &connection)
+            {
+                while (serve(connection)) { }
+            }
+
+            RpcStatus dispatch(uint32_t method, const char *request, size_t requestSize,
+                               char *reply, size_t *replySize)
+            {
+                static constexpr uint32_t ids[] = { Methods::id... };
+                static constexpr Invoker invokers[] = { &Methods::invoke... };
+                static_assert(detail::rpcUniqueIds(ids), "RPC method IDs must be unique");
+
+                for (size_t i = 0; i < methodCount; i++) {
+                    if (ids[i] != method) continue;
+
+                    auto start = std::chrono::steady_clock::now();
+                    RpcStatus status = invokers[i](request, requestSize, reply, replySize);
+                    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+
+                    Counters &counter = counters[i];
+                    counter.calls.fetch_add(1, std::memory_order_relaxed);
+                    if (status != RpcOk)
+                        counter.failures.fetch_add(1, std::memory_order_relaxed);
+                    counter.totalNs.fetch_add(elapsed, std::memory_order_relaxed);
+                    uint64_t max = counter.maxNs.load(std::memory_order_relaxed);
+                    while (elapsed > max &&
+                           !counter.maxNs.compare_exchange_weak(max, elapsed,
+                                                                std::memory_order_relaxed)) { }
+                    return status;
+                }
+
+                return RpcUnknownMethod;
+            }
+
+            // Counters of the index-th method in the template argument list
+            MethodStats getStats(size_t index)
+            {
+                static constexpr uint32_t ids[] = { Methods::id... };
+                MethodStats stats = {};
+                if (index >= methodCount) return stats;
+
+                stats.id = ids[index];
+                stats.calls = counters[index].calls.load(std::memory_order_relaxed);
+                stats.failures = counters[index].failures.load(std::memory_order_relaxed);
+                stats.totalNs = counters[index].totalNs.load(std::memory_order_relaxed);
+                stats.maxNs = counters[index].maxNs.load(std::memory_order_relaxed);
+                return stats;
+            }
+
+        private:
+            typedef RpcStatus (*Invoker)(const char *, size_t, char *, size_t *);
+
+            struct Counters {
+                std::atomic<uint64_t> calls{0};
+                std::atomic<uint64_t> failures{0};
+                std::atomic<uint64_t> totalNs{0};
+                std::atomic<uint64_t> maxNs{0};
+            };
+
+            Counters counters[methodCount];
+    };
+
+    // Call a method over a connection. status, if given, receives the
+    // server's verdict; reply is only filled in when that is RpcOk.
+    template <typename Method>
+    bool rpcCall(Connection &connection, const typename Method::Request &request,
+                 typename Method::Reply &reply, RpcStatus *status = NULL)
+    {
+        const size_t requestSize = sizeof(RpcHeader) + sizeof(typename Method::Request);
+        const size_t replySize = sizeof(RpcHeader) + sizeof(typename Method::Reply);
+        alignas(RpcHeader) char buffer[requestSize > replySize ? requestSize : replySize];
+
+        RpcHeader header = { Method::id, RpcOk };
+        memcpy(buffer, &header, sizeof(header));
+        memcpy(buffer + sizeof(header), &request, sizeof(request));
+        if (!connection.send(buffer, requestSize)) return false;
+
+        size_t received = 0;
+        if (!connection.recv(buffer, sizeof(buffer), &received) ||
+            received < sizeof(RpcHeader))
+            return false;
+
+        memcpy(&header, buffer, sizeof(header));
+        if (status) *status = (RpcStatus)header.status;
+        if (header.status != RpcOk) return true;
+        if (header.method != Method::id || received != replySize) return false;
+
+        memcpy(&reply, buffer + sizeof(header), sizeof(reply));
+        return true;
+    }
+
+}; // namespace Ipc
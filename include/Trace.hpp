@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Ipc {
+
+    // Prepended to sampled requests and their replies only; all other
+    // messages go out unchanged. Only connections made by Client::connect()
+    // start samples, the accepting side just answers them. Both ends of a
+    // connection must enable tracing to take part in sampling.
+    //
+    // The receiver recognizes a header by its 64-bit magic, its flags and a
+    // check over the whole header. An untraced payload that happens to
+    // begin with a valid header (a chance of about 2^-96 for arbitrary
+    // data, but possible on purpose) loses those bytes when the receiver
+    // traces; keep tracing off for connections carrying untrusted data.
+    //
+    // Times are CLOCK_MONOTONIC nanoseconds; the stage durations are filled
+    // in by the peer answering a sampled request and saturate at about 4
+    // seconds.
+    struct TraceHeader {
+        uint64_t magic;
+        uint32_t flags;
+        uint32_t check;                     // over the header, check taken as 0
+        uint64_t sendTime;                  // request handed to send()
+        uint32_t id;
+        uint32_t requestTransit;            // send() to kernel enqueue
+        uint32_t requestWakeup;             // kernel enqueue to recv() return
+        uint32_t processing;                // recv() return to reply send()
+    };
+
+    struct TraceOptions {
+        unsigned sampleEvery = 64;          // 1 traces every request
+        size_t maxEvents = 64 * 1024;       // samples kept for export
+    };
+
+    // One-way latency tracing. The requester stamps a sample of its
+    // messages, the peer adds its receive and processing times to the
+    // reply, and the requester aggregates the complete breakdown.
+    // Linux only.
+    class Trace {
+        public:
+            enum Stage {
+                RequestTransit,
+                RequestWakeup,
+                Processing,
+                ReplyTransit,
+                ReplyWakeup,
+                RoundTrip,
+                StageCount,
+            };
+
+            // Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds
+            struct Histogram {
+                uint64_t count;
+                uint64_t totalNs;
+                uint64_t maxNs;
+                uint64_t buckets[64];
+            };
+
+            static void enable(const TraceOptions &options = TraceOptions());
+            static void disable();
+            static void reset();
+
+            static bool isEnabled()
+            {
+                return enabled.load(std::memory_order_relaxed);
+            }
+
+            static const char *getStageName(Stage stage);
+            static Histogram getHistogram(Stage stage);
+
+            // Upper bound of the bucket holding the given fraction of samples
+            static uint64_t getPercentile(Stage stage, double fraction);
+
+            // Chrome trace event format, loadable in Perfetto or
+            // chrome://tracing
+            static bool writeChromeTrace(const std::string &path);
+
+        private:
+            // Returns a nonzero sample ID when this request should be traced
+            static uint32_t sample();
+            static void record(uint64_t connectionId, const TraceHeader &header,
+                               uint64_t replyKernelTime, uint64_t replyReceiveTime);
+
+            static std::atomic<bool> enabled;
+
+            friend class Connection;
+    };
+
+}; // namespace Ipc
@@ -0,0 +1,515 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux) || defined(__linux__) || defined(linux)
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "Capture.hpp"
+
+namespace Ipc {
+
+    std::atomic<bool> Capture::active(false);
+
+#if defined(__linux) || defined(__linux__) || defined(linux)
+
+    static const char SEGMENT_MAGIC[8] = { 'I', 'P', 'C', 'C', 'A', 'P', '0', '1' };
+    static const size_t SEGMENT_HEADER_SIZE = 16;
+
+    static size_t recordLength(size_t payloadSize)
+    {
+        return (sizeof(CaptureRecord) + payloadSize + 7) & ~(size_t)7;
+    }
+
+    static std::string segmentName(const std::string &path, unsigned segment)
+    {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), ".%04u", segment);
+        return path + suffix;
+    }
+
+    static uint64_t monotonicNow()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    // Every recording thread gets its own single producer ring, so the hot
+    // path is a timestamp and a memcpy without any shared lock. The thread
+    // only advances head, the writer thread only advances tail. Rings are
+    // never freed; a ring whose thread has exited is handed to the next new
+    // thread once the writer has emptied it.
+    struct CaptureRing {
+        std::unique_ptr<char[]> data;
+        size_t size;
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> tail;
+
+        // Set while the owner is inside record(); stop() waits for it
+        std::atomic<bool> busy;
+        std::atomic<bool> owned;
+
+        std::atomic<uint64_t> recorded;
+        std::atomic<uint64_t> dropped;
+    };
+
+    // Writer state lives for the whole process so that a producer racing
+    // with stop() never touches freed memory; start() just reinitializes it.
+    static struct {
+        std::string path;
+        CaptureOptions options;
+
+        std::mutex ringsMutex;
+        std::vector<CaptureRing *> rings;
+
+        std::mutex controlMutex;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        bool stopping;
+        std::thread thread;
+
+        int fd;
+        char *map;
+        size_t used;
+        unsigned segment;
+
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> bytesWritten;
+        std::atomic<uint64_t> segments;
+    } writer;
+
+    // Stops a capture still running at exit, so the writer thread is joined
+    // and the last segment flushed before the writer state is destroyed
+    static struct CaptureShutdown {
+        ~CaptureShutdown()
+        {
+            Capture::stop();
+        }
+    } captureShutdown;
+
+    static thread_local struct CaptureRingHandle {
+        CaptureRing *ring = NULL;
+
+        ~CaptureRingHandle()
+        {
+            if (ring) ring->owned.store(false, std::memory_order_release);
+        }
+    } localRing;
+
+    static void ringWrite(CaptureRing *ring, uint64_t position, const void *src, size_t size)
+    {
+        size_t offset = position % ring->size;
+        size_t first = std::min(size, ring->size - offset);
+        memcpy(&ring->data[offset], src, first);
+        memcpy(&ring->data[0], (const char *)src + first, size - first);
+    }
+
+    static void ringRead(CaptureRing *ring, uint64_t position, void *dst, size_t size)
+    {
+        size_t offset = position % ring->size;
+        size_t first = std::min(size, ring->size - offset);
+        memcpy(dst, &ring->data[offset], first);
+        memcpy((char *)dst + first, &ring->data[0], size - first);
+    }
+
+    static CaptureRing *acquireRing()
+    {
+        std::lock_guard<std::mutex> lock(writer.ringsMutex);
+
+        for (CaptureRing *ring : writer.rings) {
+            if (!ring->owned.load(std::memory_order_acquire) &&
+                ring->head.load(std::memory_order_relaxed) ==
+                ring->tail.load(std::memory_order_acquire)) {
+                ring->owned.store(true, std::memory_order_relaxed);
+                return ring;
+            }
+        }
+
+        CaptureRing *ring = new CaptureRing();
+        ring->data.reset(new char[writer.options.ringSize]);
+        ring->size = writer.options.ringSize;
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->busy.store(false);
+        ring->owned.store(true);
+        ring->recorded.store(0);
+        ring->dropped.store(0);
+        writer.rings.push_back(ring);
+        return ring;
+    }
+
+    static bool openSegment()
+    {
+        std::string name = segmentName(writer.path, writer.segment);
+
+        writer.map = NULL;
+        if ((writer.fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+            perror("open");
+            return false;
+        }
+
+        if (::ftruncate(writer.fd, writer.options.segmentSize) == -1) {
+            perror("ftruncate");
+            ::close(writer.fd);
+            writer.fd = -1;
+            return false;
+        }
+
+        void *map = ::mmap(NULL, writer.options.segmentSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, writer.fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            ::close(writer.fd);
+            writer.fd = -1;
+            return false;
+        }
+
+        writer.map = (char *)map;
+        memcpy(writer.map, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+        writer.used = SEGMENT_HEADER_SIZE;
+        writer.segments++;
+        return true;
+    }
+
+    static void closeSegment()
+    {
+        ::munmap(writer.map, writer.options.segmentSize);
+        // Drop the unused preallocated tail
+        if (::ftruncate(writer.fd, writer.used) == -1) {
+            perror("ftruncate");
+        }
+        ::close(writer.fd);
+        writer.map = NULL;
+        writer.fd = -1;
+    }
+
+    static void drain()
+    {
+        std::vector<CaptureRing *> rings;
+        {
+            std::lock_guard<std::mutex> lock(writer.ringsMutex);
+            rings = writer.rings;
+        }
+
+        std::vector<uint64_t> heads(rings.size());
+        for (size_t i = 0; i < rings.size(); i++)
+            heads[i] = rings[i]->head.load(std::memory_order_acquire);
+
+        // Merge what the rings hold by timestamp. Records published after
+        // this snapshot may still be older than the last one written.
+        for (;;) {
+            CaptureRing *next = NULL;
+            CaptureRecord record;
+            for (size_t i = 0; i < rings.size(); i++) {
+                uint64_t tail = rings[i]->tail.load(std::memory_order_relaxed);
+                if (tail >= heads[i]) continue;
+
+                CaptureRecord candidate;
+                ringRead(rings[i], tail, &candidate, sizeof(candidate));
+                if (!next || candidate.timestamp < record.timestamp) {
+                    next = rings[i];
+                    record = candidate;
+                }
+            }
+            if (!next) break;
+
+            uint64_t tail = next->tail.load(std::memory_order_relaxed);
+            size_t length = recordLength(record.size);
+
+            if (writer.map && writer.used + length > writer.options.segmentSize) {
+                closeSegment();
+                writer.segment++;
+                openSegment();
+            }
+
+            if (!writer.map) {
+                // Nowhere to write after a failed rotation
+                writer.dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                ringRead(next, tail, writer.map + writer.used, length);
+                writer.used += length;
+                writer.bytesWritten.fetch_add(length, std::memory_order_relaxed);
+            }
+            next->tail.store(tail + length, std::memory_order_release);
+        }
+    }
+
+    static void writerLoop()
+    {
+        std::chrono::milliseconds interval(writer.options.flushIntervalMs);
+
+        for (;;) {
+            drain();
+
+            std::unique_lock<std::mutex> lock(writer.wakeMutex);
+            if (writer.stopping) break;
+            writer.wake.wait_for(lock, interval);
+        }
+
+        drain();
+        if (writer.map) closeSegment();
+    }
+
+    bool Capture::start(const std::string &path, const CaptureOptions &options)
+    {
+        std::lock_guard<std::mutex> control(writer.controlMutex);
+        if (isActive()) return false;
+
+        if (options.ringSize < sizeof(CaptureRecord) ||
+            options.segmentSize < SEGMENT_HEADER_SIZE + sizeof(CaptureRecord)) {
+            return false;
+        }
+
+        writer.path = path;
+        writer.options = options;
+        writer.stopping = false;
+        writer.segment = 0;
+        writer.dropped.store(0);
+        writer.bytesWritten.store(0);
+        writer.segments.store(0);
+
+        // No producer is inside record() while capture is stopped
+        {
+            std::lock_guard<std::mutex> lock(writer.ringsMutex);
+            for (CaptureRing *ring : writer.rings) {
+                if (ring->size != options.ringSize) {
+                    ring->data.reset(new char[options.ringSize]);
+                    ring->size = options.ringSize;
+                }
+                ring->head.store(0);
+                ring->tail.store(0);
+                ring->recorded.store(0);
+                ring->dropped.store(0);
+            }
+        }
+
+        if (!openSegment()) return false;
+
+        writer.thread = std::thread(writerLoop);
+        active.store(true);
+        return true;
+    }
+
+    void Capture::stop()
+    {
+        std::lock_guard<std::mutex> control(writer.controlMutex);
+        if (!writer.thread.joinable()) return;
+
+        active.store(false);
+        {
+            // Wait out any producer that saw active before it was cleared
+            std::lock_guard<std::mutex> lock(writer.ringsMutex);
+            for (CaptureRing *ring : writer.rings) {
+                while (ring->busy.load())
+                    std::this_thread::yield();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(writer.wakeMutex);
+            writer.stopping = true;
+        }
+        writer.wake.notify_one();
+        writer.thread.join();
+    }
+
+    Capture::Stats Capture::getStats()
+    {
+        Stats stats = {};
+        {
+            std::lock_guard<std::mutex> lock(writer.ringsMutex);
+            for (CaptureRing *ring : writer.rings) {
+                stats.recorded += ring->recorded.load(std::memory_order_relaxed);
+                stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+            }
+        }
+        stats.dropped += writer.dropped.load(std::memory_order_relaxed);
+        stats.bytesWritten = writer.bytesWritten.load(std::memory_order_relaxed);
+        stats.segments = writer.segments.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void Capture::record(uint64_t connectionId, CaptureRecord::Direction direction,
+                         const char *data, size_t size)
+    {
+        CaptureRing *ring = localRing.ring;
+        if (!ring) ring = localRing.ring = acquireRing();
+
+        // Pairs with stop() clearing active and then checking busy
+        ring->busy.store(true);
+        if (!isActive()) {
+            ring->busy.store(false, std::memory_order_release);
+            return;
+        }
+
+        CaptureRecord record;
+        record.timestamp = monotonicNow();
+        record.connectionId = connectionId;
+        record.size = size;
+        record.direction = direction;
+        memset(record.reserved, 0, sizeof(record.reserved));
+
+        size_t length = recordLength(size);
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        if (length > ring->size - (head - tail) ||
+            length > writer.options.segmentSize - SEGMENT_HEADER_SIZE) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            ringWrite(ring, head, &record, sizeof(record));
+            ringWrite(ring, head + sizeof(record), data, size);
+            ring->head.store(head + length, std::memory_order_release);
+            ring->recorded.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ring->busy.store(false, std::memory_order_release);
+    }
+
+    CaptureReader::CaptureReader(const std::string &path)
+        : path(path), segment(0), data(NULL), size(0), offset(0)
+    {
+        openSegment();
+    }
+
+    CaptureReader::~CaptureReader()
+    {
+        closeSegment();
+    }
+
+    bool CaptureReader::openSegment()
+    {
+        std::string name = segmentName(path, segment);
+
+        int fd;
+        if ((fd = ::open(name.c_str(), O_RDONLY)) == -1) {
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == -1 || (size_t)st.st_size < SEGMENT_HEADER_SIZE) {
+            ::close(fd);
+            return false;
+        }
+
+        void *map = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+
+        data = (const char *)map;
+        size = st.st_size;
+        offset = SEGMENT_HEADER_SIZE;
+
+        if (memcmp(data, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0) {
+            closeSegment();
+            return false;
+        }
+        return true;
+    }
+
+    void CaptureReader::closeSegment()
+    {
+        if (data) ::munmap((void *)data, size);
+        data = NULL;
+        size = 0;
+        offset = 0;
+    }
+
+    bool CaptureReader::next(CaptureRecord &record, std::vector<char> &payload)
+    {
+        while (data) {
+            if (offset + sizeof(record) <= size) {
+                memcpy(&record, data + offset, sizeof(record));
+
+                // A segment left behind by a crashed writer is zero filled
+                // past the last record
+                bool end = record.timestamp == 0 && record.size == 0;
+                if (!end && offset + sizeof(record) + record.size <= size) {
+                    payload.assign(data + offset + sizeof(record),
+                                   data + offset + sizeof(record) + record.size);
+                    offset += recordLength(record.size);
+                    return true;
+                }
+            }
+
+            closeSegment();
+            segment++;
+            openSegment();
+        }
+        return false;
+    }
+
+#else
+
+    bool Capture::start(const std::string &path, const CaptureOptions &options)
+    {
+        return false;
+    }
+
+    void Capture::stop() { }
+
+    Capture::Stats Capture::getStats()
+    {
+        Stats stats = {};
+        return stats;
+    }
+
+    void Capture::record(uint64_t connectionId, CaptureRecord::Direction direction,
+                         const char *data, size_t size) { }
+
+    CaptureReader::CaptureReader(const std::string &path)
+        : path(path), segment(0), data(NULL), size(0), offset(0) { }
+    CaptureReader::~CaptureReader() { }
+    bool CaptureReader::openSegment()
+    {
+        return false;
+    }
+    void CaptureReader::closeSegment() { }
+    bool CaptureReader::next(CaptureRecord &record, std::vector<char> &payload)
+    {
+        return false;
+    }
+
+#endif
+
+}; // namespace Ipc
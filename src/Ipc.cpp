@@ -22,27 +22,149 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <sstream>
 
 #if defined(__linux) || defined(__linux__) || defined(linux)
 #include <errno.h>
 #include <linux/sockios.h>
+#include <poll.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #endif
 
+#include "Capture.hpp"
 #include "Ipc.hpp"
+#include "ResponseCache.hpp"
+#include "Trace.hpp"
 
 namespace Ipc {
 
     const int BUFSIZE = 1024;
 
+    static std::mutex tuningMutex;
+    static BufferTuning tuning;
+    static std::atomic<bool> tuningEnabled(false);
+    static std::atomic<unsigned> tuningInterval(64);
+    static std::atomic<size_t> bufferMemory(0);
+    static std::atomic<uint64_t> nextConnectionId(1);
+
+    void setBufferTuning(const BufferTuning &newTuning)
+    {
+        std::lock_guard<std::mutex> lock(tuningMutex);
+        tuning = newTuning;
+        tuningInterval.store(newTuning.sampleInterval ? newTuning.sampleInterval : 1,
+                             std::memory_order_relaxed);
+        tuningEnabled.store(newTuning.enabled, std::memory_order_relaxed);
+    }
+
+    BufferTuning getBufferTuning()
+    {
+        std::lock_guard<std::mutex> lock(tuningMutex);
+        return tuning;
+    }
+
+    size_t getBufferMemory()
+    {
+        return bufferMemory.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Connection::getId()
+    {
+        return id;
+    }
+
+    bool Connection::isTruncated()
+    {
+        return truncated;
+    }
+
+    const std::string &Endpoint::getName() const
+    {
+        return name;
+    }
+
+    Endpoint::Namespace Endpoint::getNamespace() const
+    {
+        return space;
+    }
+
+    unsigned Endpoint::getListenerCount() const
+    {
+        return listeners;
+    }
+
+    Endpoint Endpoint::getChannel(const std::string &suffix) const
+    {
+        return Endpoint(name + suffix, space, 1);
+    }
+
+    void Server::init(std::string name, int backlog)
+    {
+        init(Endpoint(name), backlog);
+    }
+
+    void CacheInvalidator::init(std::string name)
+    {
+        init(Endpoint(name));
+    }
+
+    Client::Client(std::string name) : Client(Endpoint(name)) { }
+
+    Client::Client(const Endpoint &endpoint) : endpoint(endpoint), nextListener(0) { }
+
+    Client::~Client() { }
+
+    void Client::enableCache(const CacheOptions &options)
+    {
+        cache.reset(new ResponseCache(endpoint, options));
+    }
+
+    void Client::disableCache()
+    {
+        cache.reset();
+    }
+
+    CacheStats Client::getCacheStats()
+    {
+        if (cache) return cache->getStats();
+
+        CacheStats stats = {};
+        return stats;
+    }
+
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
-    Connection::Connection(HANDLE inPipe) : inPipe(inPipe) { }
+    Connection::Connection(HANDLE inPipe)
+        : inPipe(inPipe), id(nextConnectionId.fetch_add(1, std::memory_order_relaxed)) { }
+
+    Connection::Connection(Connection &&other)
+        : inPipe(other.inPipe), id(other.id), stats(other.stats), truncated(other.truncated)
+    {
+        other.inPipe = INVALID_HANDLE_VALUE;
+    }
+
+    Connection& Connection::operator=(Connection &&other)
+    {
+        if (this != &other) {
+            if (!isInvalid())
+                DisconnectNamedPipe(inPipe);
+            inPipe = other.inPipe;
+            id = other.id;
+            stats = other.stats;
+            truncated = other.truncated;
+            other.inPipe = INVALID_HANDLE_VALUE;
+        }
+        return *this;
+    }
 
     Connection::~Connection()
     {
@@ -58,6 +180,8 @@ namespace Ipc {
         if (WriteFile(inPipe, src, srcSize, &dwWritten, NULL) != FALSE)
         {
             if (bytesSent) *bytesSent = dwWritten;
+            if (Capture::isActive())
+                Capture::record(id, CaptureRecord::Sent, src, dwWritten);
             return true;
         }
         else
@@ -71,9 +195,22 @@ namespace Ipc {
         if (isInvalid()) return false;
 
         DWORD dwRead;
-        if (ReadFile(inPipe, dst, dstSize, &dwRead, NULL) != FALSE)
+        BOOL fSuccess = ReadFile(inPipe, dst, dstSize, &dwRead, NULL);
+        if (fSuccess != FALSE || GetLastError() == ERROR_MORE_DATA)
         {
+            // Drop the rest of a message that didn't fit, as a
+            // SOCK_SEQPACKET socket does
+            truncated = fSuccess == FALSE;
+            while (fSuccess == FALSE) {
+                CHAR discard[BUFSIZE];
+                DWORD dwDiscarded;
+                fSuccess = ReadFile(inPipe, discard, sizeof(discard), &dwDiscarded, NULL);
+                if (fSuccess == FALSE && GetLastError() != ERROR_MORE_DATA) break;
+            }
+
             if (bytesReceived) *bytesReceived = dwRead;
+            if (Capture::isActive() && dwRead > 0)
+                Capture::record(id, CaptureRecord::Received, dst, dwRead);
             return true;
         }
         else
@@ -104,12 +241,28 @@ namespace Ipc {
         return inPipe == INVALID_HANDLE_VALUE;
     }
 
+    // Pipe buffer sizes are fixed at CreateNamedPipe time
+    void Connection::tune() { }
+
+    Connection::Stats Connection::getStats()
+    {
+        return stats;
+    }
+
+    Endpoint::Endpoint(std::string name, Namespace space, unsigned listeners)
+        : name(name), space(space), listeners(1) { }
+
+    bool Endpoint::isInvalid() const
+    {
+        return name.empty();
+    }
+
     Server::Server() { }
 
-    void Server::init(std::string name)
+    void Server::init(const Endpoint &endpoint, int backlog)
     {
         std::stringstream ss;
-        ss << "\\\\.\\pipe\\" << name;
+        ss << "\\\\.\\pipe\\" << endpoint.getName();
         std::string inPipeName = ss.str();
 
         inPipe = CreateNamedPipeA(inPipeName.c_str(),
@@ -128,17 +281,20 @@ namespace Ipc {
         return Connection(inPipe);
     }
 
-    Client::Client(std::string name) : name(name) { }
-
     bool Client::sendrecv(char *dst, size_t dstSize, const char *src, size_t srcSize,
-                          size_t *bytesReceived = NULL)
+                          size_t *bytesReceived, bool useCache)
     {
         CHAR chReadBuf[BUFSIZE];
         BOOL fSuccess;
         DWORD cbRead;
 
+        ResponseCache *cache = useCache ? this->cache.get() : NULL;
+        uint64_t generation = 0;
+        if (cache && cache->lookup(src, srcSize, dst, dstSize, bytesReceived, &generation))
+            return true;
+
         std::stringstream ss;
-        ss << "\\\\.\\pipe\\" << name;
+        ss << "\\\\.\\pipe\\" << endpoint.getName();
         std::string outPipeName = ss.str();
 
         fSuccess = CallNamedPipeA(
@@ -153,6 +309,10 @@ namespace Ipc {
         if (fSuccess || GetLastError() == ERROR_MORE_DATA)
         {
             if (bytesReceived) *bytesReceived = cbRead;
+            // A reply cut short by ERROR_MORE_DATA isn't the whole reply,
+            // and an empty one means the server gave none
+            if (cache && fSuccess && cbRead > 0)
+                cache->store(src, srcSize, dst, cbRead, generation);
             return true;
         }
         else
@@ -164,7 +324,7 @@ namespace Ipc {
     Connection Client::connect()
     {
         std::stringstream ss;
-        ss << "\\\\.\\pipe\\" << name;
+        ss << "\\\\.\\pipe\\" << endpoint.getName();
         std::string inPipeName = ss.str();
 
         HANDLE inPipe = CreateFileA(inPipeName.c_str(),
@@ -179,63 +339,390 @@ namespace Ipc {
 
 #elif defined(__linux) || defined(__linux__) || defined(linux)
 
-    Server::Server() { }
+    const uint64_t TRACE_MAGIC = 0x4543415254435049ull;    // "IPCTRACE"
+    const uint32_t TRACE_REQUEST = 1;
+    const uint32_t TRACE_REPLY = 2;
 
-    void Server::init(std::string name)
+    // FNV-1a over the header with the check field taken as 0
+    static uint32_t traceCheck(const TraceHeader &header)
     {
-        struct sockaddr_un local;
+        TraceHeader copy = header;
+        copy.check = 0;
 
-        if ((listenfd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
-            perror("socket");
+        const unsigned char *bytes = (const unsigned char *)&copy;
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(copy); i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
         }
+        return hash;
+    }
 
-        std::stringstream ss;
-        ss << "/tmp/" << name;
-        std::string sockpath = ss.str();
+    static bool isTraceHeader(const TraceHeader &header)
+    {
+        return header.magic == TRACE_MAGIC &&
+               (header.flags == TRACE_REQUEST || header.flags == TRACE_REPLY) &&
+               header.check == traceCheck(header);
+    }
+
+    static uint64_t clockNow(clockid_t clock)
+    {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
 
-        local.sun_family = AF_UNIX;
-        strcpy(local.sun_path, sockpath.c_str());
-        unlink(local.sun_path);
-        int len = strlen(local.sun_path) + sizeof(local.sun_family);
-        if (::bind(listenfd, (struct sockaddr *)&local, len) == -1) {
-            perror("bind");
+    static uint32_t traceDuration(uint64_t begin, uint64_t end)
+    {
+        if (end <= begin) return 0;
+        return std::min<uint64_t>(end - begin, UINT32_MAX);
+    }
+
+    Endpoint::Endpoint(std::string name, Namespace space, unsigned listeners)
+        : name(name), space(space), listeners(listeners ? listeners : 1)
+    {
+        for (unsigned i = 0; i < this->listeners; i++) {
+            std::stringstream ss;
+            if (space == Abstract)
+                ss << '\0' << "ipc/" << name;
+            else
+                ss << "/tmp/" << name;
+            if (this->listeners > 1)
+                ss << "." << i;
+            std::string path = ss.str();
+
+            Address address;
+            memset(&address.addr, 0, sizeof(address.addr));
+            address.addr.sun_family = AF_UNIX;
+
+            // Filesystem paths need room for their terminating NUL
+            size_t room = sizeof(address.addr.sun_path) - (space == Abstract ? 0 : 1);
+            if (path.size() > room) {
+                errno = ENAMETOOLONG;
+                perror(name.c_str());
+                addresses.clear();
+                return;
+            }
+
+            memcpy(address.addr.sun_path, path.data(), path.size());
+            address.len = offsetof(struct sockaddr_un, sun_path) + path.size();
+            addresses.push_back(address);
         }
+    }
 
-        if (::listen(listenfd, 5) == -1) {
-            perror("listen");
+    bool Endpoint::isInvalid() const
+    {
+        return addresses.size() != listeners;
+    }
+
+    Server::Server() { }
+
+    void Server::init(const Endpoint &endpoint, int backlog)
+    {
+        if (endpoint.isInvalid()) {
+            // Leaves no listeners, so accept() fails instead of waiting
+            errno = ENAMETOOLONG;
+            perror(endpoint.getName().c_str());
+            return;
+        }
+
+        for (const Endpoint::Address &address : endpoint.addresses) {
+            int listenfd;
+
+            if ((listenfd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+                perror("socket");
+                continue;
+            }
+
+            if (endpoint.getNamespace() == Endpoint::Filesystem)
+                unlink(address.addr.sun_path);
+            if (::bind(listenfd, (const struct sockaddr *)&address.addr, address.len) == -1) {
+                perror("bind");
+            }
+
+            if (::listen(listenfd, backlog) == -1) {
+                perror("listen");
+            }
+
+            listenfds.push_back(listenfd);
         }
     }
 
     Connection Server::accept()
     {
         struct sockaddr_un remote;
-        int connfd;
+        int connfd = -1;
         socklen_t t = sizeof(remote);
-        if ((connfd = ::accept(listenfd, (struct sockaddr *)&remote, &t)) == -1) {
-            perror("accept");
+
+        if (listenfds.empty()) return Connection(-1);
+
+        if (listenfds.size() == 1) {
+            if ((connfd = ::accept(listenfds[0], (struct sockaddr *)&remote, &t)) == -1) {
+                perror("accept");
+            }
+            return Connection(connfd);
+        }
+
+        std::vector<struct pollfd> fds(listenfds.size());
+        for (size_t i = 0; i < listenfds.size(); i++) {
+            fds[i].fd = listenfds[i];
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+
+        if (::poll(fds.data(), fds.size(), -1) == -1) {
+            perror("poll");
+            return Connection(-1);
+        }
+
+        // Start after the listener served last so none of them starves
+        for (size_t n = 0; n < fds.size(); n++) {
+            size_t i = (nextListener + n) % fds.size();
+            if (!(fds[i].revents & POLLIN)) continue;
+
+            nextListener = i + 1;
+            if ((connfd = ::accept(listenfds[i], (struct sockaddr *)&remote, &t)) == -1) {
+                perror("accept");
+            }
+            break;
         }
         return Connection(connfd);
     }
 
-    Connection::Connection(int connfd) : connfd(connfd) { }
+    Connection::Connection(int connfd) : connfd(connfd)
+    {
+        if (!isInvalid())
+            id = nextConnectionId.fetch_add(1, std::memory_order_relaxed);
+        if (!isInvalid() && Trace::isEnabled())
+            enableTimestamps();
+        if (!isInvalid() && tuningEnabled.load(std::memory_order_relaxed))
+            initBuffers();
+    }
+
+    Connection::Connection(Connection &&other)
+        : connfd(other.connfd),
+          buffersAccounted(other.buffersAccounted),
+          opsSinceTune(other.opsSinceTune),
+          windowSendQueue(other.windowSendQueue),
+          trace(other.trace),
+          id(other.id),
+          stats(other.stats),
+          truncated(other.truncated)
+    {
+        other.connfd = -1;
+        other.buffersAccounted = false;
+    }
+
+    Connection& Connection::operator=(Connection &&other)
+    {
+        if (this != &other) {
+            releaseBuffers();
+            if (!isInvalid())
+                ::close(connfd);
+            connfd = other.connfd;
+            buffersAccounted = other.buffersAccounted;
+            opsSinceTune = other.opsSinceTune;
+            windowSendQueue = other.windowSendQueue;
+            trace = other.trace;
+            id = other.id;
+            stats = other.stats;
+            truncated = other.truncated;
+            other.connfd = -1;
+            other.buffersAccounted = false;
+        }
+        return *this;
+    }
 
     Connection::~Connection()
     {
+        releaseBuffers();
         if (!isInvalid())
             ::close(connfd);
     }
+
+    void Connection::initBuffers()
+    {
+        BufferTuning current = getBufferTuning();
+
+        if (current.initialSize) {
+            // The kernel doubles the requested value for bookkeeping overhead
+            int requested = current.initialSize / 2;
+            ::setsockopt(connfd, SOL_SOCKET, SO_SNDBUF, &requested, sizeof(requested));
+        }
+
+        int size = 0;
+        socklen_t len = sizeof(size);
+        if (::getsockopt(connfd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0)
+            stats.sendBufferSize = size;
+        len = sizeof(size);
+        if (::getsockopt(connfd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0)
+            stats.recvBufferSize = size;
+
+        // AF_UNIX charges queued messages to the sender's SO_SNDBUF and
+        // never looks at SO_RCVBUF, so only send buffers count. Once the
+        // process limit is used up, new connections start at minSize
+        // rather than push every later grow into bufferDenied.
+        size_t wanted = stats.sendBufferSize;
+        size_t used = bufferMemory.load(std::memory_order_relaxed);
+        size_t granted;
+        do {
+            size_t room = used < current.processLimit ? current.processLimit - used : 0;
+            granted = std::min(wanted, std::max(room, current.minSize));
+        } while (!bufferMemory.compare_exchange_weak(used, used + granted,
+                                                     std::memory_order_relaxed));
+        buffersAccounted = true;
+
+        if (granted < wanted) {
+            stats.sendBufferSize = applySendBuffer(granted);
+            stats.bufferDenied++;
+        }
+    }
+
+    void Connection::releaseBuffers()
+    {
+        if (buffersAccounted) {
+            bufferMemory.fetch_sub(stats.sendBufferSize, std::memory_order_relaxed);
+            buffersAccounted = false;
+        }
+    }
+
+    // Sets SO_SNDBUF to a size already accounted in bufferMemory and returns
+    // the size the kernel applied, with the account corrected to match
+    size_t Connection::applySendBuffer(size_t accounted)
+    {
+        int requested = accounted / 2;
+        ::setsockopt(connfd, SOL_SOCKET, SO_SNDBUF, &requested, sizeof(requested));
+
+        // The kernel may clamp the value (net.core.wmem_max), so
+        // account for whatever it actually applied
+        int actual = 0;
+        socklen_t len = sizeof(actual);
+        if (::getsockopt(connfd, SOL_SOCKET, SO_SNDBUF, &actual, &len) < 0)
+            actual = accounted;
+        if ((size_t)actual >= accounted)
+            bufferMemory.fetch_add(actual - accounted, std::memory_order_relaxed);
+        else
+            bufferMemory.fetch_sub(accounted - actual, std::memory_order_relaxed);
+        return actual;
+    }
+
+    bool Connection::resizeSendBuffer(size_t newSize)
+    {
+        size_t &size = stats.sendBufferSize;
+
+        if (newSize > size) {
+            // Reserve the growth up front so concurrent connections can't
+            // overshoot the process limit between them
+            size_t limit = getBufferTuning().processLimit;
+            size_t delta = newSize - size;
+            size_t used = bufferMemory.load(std::memory_order_relaxed);
+            do {
+                if (used + delta > limit) {
+                    stats.bufferDenied++;
+                    return false;
+                }
+            } while (!bufferMemory.compare_exchange_weak(used, used + delta,
+                                                         std::memory_order_relaxed));
+        }
+        else {
+            bufferMemory.fetch_sub(size - newSize, std::memory_order_relaxed);
+        }
+
+        size_t actual = applySendBuffer(newSize);
+        bool changed = actual != size;
+        size = actual;
+        return changed;
+    }
+
+    // The send queue peaks right after a send, so send() samples it too and
+    // decisions see the peak since the last one
+    void Connection::sampleSendQueue()
+    {
+        int sendQueue = 0;
+        if (::ioctl(connfd, SIOCOUTQ, &sendQueue) < 0) return;
+
+        if ((size_t)sendQueue > stats.peakSendQueue) stats.peakSendQueue = sendQueue;
+        if ((size_t)sendQueue > windowSendQueue) windowSendQueue = sendQueue;
+    }
+
+    void Connection::tune()
+    {
+        if (isInvalid()) return;
+
+        opsSinceTune = 0;
+        if (!buffersAccounted)
+            initBuffers();
+
+        sampleSendQueue();
+        int recvQueue = 0;
+        if (::ioctl(connfd, FIONREAD, &recvQueue) < 0) recvQueue = 0;
+        if ((size_t)recvQueue > stats.peakRecvQueue) stats.peakRecvQueue = recvQueue;
+
+        BufferTuning current = getBufferTuning();
+        size_t size = stats.sendBufferSize;
+        if (size == 0) return;
+
+        if (windowSendQueue >= size - size / 4 && size < current.maxSize) {
+            // Queue ran at least 3/4 full since the last decision
+            if (resizeSendBuffer(std::min(size * 2, current.maxSize)))
+                stats.bufferGrows++;
+            windowSendQueue = 0;
+        }
+        else if (windowSendQueue <= size / 8 && size > current.minSize) {
+            // Queue stayed below 1/8 of the buffer since the last decision
+            if (resizeSendBuffer(std::max(size / 2, current.minSize)))
+                stats.bufferShrinks++;
+            windowSendQueue = 0;
+        }
+    }
+
+    Connection::Stats Connection::getStats()
+    {
+        if (!isInvalid() && !buffersAccounted) {
+            int size = 0;
+            socklen_t len = sizeof(size);
+            if (::getsockopt(connfd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0)
+                stats.sendBufferSize = size;
+            len = sizeof(size);
+            if (::getsockopt(connfd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0)
+                stats.recvBufferSize = size;
+        }
+        return stats;
+    }
+
     bool Connection::send(const char *src, size_t srcSize, size_t *bytesSent)
     {
         if (isInvalid()) return false;
 
         bool ret = true;
         ssize_t sent = 0;
-        if ((sent = ::send(connfd, src, srcSize, 0)) < 0) {
+        if (Trace::isEnabled()) {
+            size_t payloadSent = 0;
+            if (sendTraced(src, srcSize, &payloadSent))
+                sent = payloadSent;
+            else
+                sent = -1;
+        }
+        else {
+            sent = ::send(connfd, src, srcSize, 0);
+        }
+
+        if (sent < 0) {
             perror("send");
             ret = false;
         }
         else {
             if (bytesSent) *bytesSent = sent;
+            stats.messagesSent++;
+            stats.bytesSent += sent;
+            if (Capture::isActive())
+                Capture::record(id, CaptureRecord::Sent, src, sent);
+        }
+
+        if (tuningEnabled.load(std::memory_order_relaxed)) {
+            if (ret && buffersAccounted) sampleSendQueue();
+            if (++opsSinceTune >= tuningInterval.load(std::memory_order_relaxed))
+                tune();
         }
 
         return ret;
@@ -247,14 +734,36 @@ namespace Ipc {
 
         bool ret = true;
         ssize_t received;
-        received = ::recv(connfd, dst, dstSize, 0);
+        if (Trace::isEnabled()) {
+            size_t payloadReceived = 0;
+            if (recvTraced(dst, dstSize, 0, &payloadReceived))
+                received = payloadReceived;
+            else
+                received = -1;
+        }
+        else {
+            // MSG_TRUNC returns the real length of a message that didn't fit
+            received = ::recv(connfd, dst, dstSize, MSG_TRUNC);
+            truncated = received > 0 && (size_t)received > dstSize;
+            if (truncated) received = dstSize;
+        }
+
         if (received < 0) {
             perror("recv");
             ret = false;
         }
         else {
             if (bytesReceived) *bytesReceived = received;
+            stats.messagesReceived++;
+            stats.bytesReceived += received;
+            if (Capture::isActive() && received > 0)
+                Capture::record(id, CaptureRecord::Received, dst, received);
         }
+
+        if (tuningEnabled.load(std::memory_order_relaxed) &&
+            ++opsSinceTune >= tuningInterval.load(std::memory_order_relaxed))
+            tune();
+
         return ret;
     }
 
@@ -265,7 +774,18 @@ namespace Ipc {
 
         bool ret = true;
         ssize_t received;
-        received = ::recv(connfd, dst, dstSize, MSG_PEEK);
+        bool hasHeader = false;
+        if (Trace::isEnabled()) {
+            size_t payloadReceived = 0;
+            if (recvTraced(dst, dstSize, MSG_PEEK, &payloadReceived, &hasHeader))
+                received = payloadReceived;
+            else
+                received = -1;
+        }
+        else {
+            received = ::recv(connfd, dst, dstSize, MSG_PEEK);
+        }
+
         if (received < 0) {
             perror("recv");
             ret = false;
@@ -273,68 +793,252 @@ namespace Ipc {
         else {
             if (bytesReceived) *bytesReceived = received;
             int available = 0;
-            if (::ioctl(connfd, FIONREAD, &available) >= 0) *bytesAvailable = available;
+            if (::ioctl(connfd, FIONREAD, &available) >= 0) {
+                // FIONREAD sums every queued message. Only the header of
+                // the message just peeked is known, so headers of sampled
+                // messages queued behind it are still counted.
+                if (hasHeader && (size_t)available >= sizeof(TraceHeader))
+                    available -= sizeof(TraceHeader);
+                if (bytesAvailable) *bytesAvailable = available;
+            }
         }
         return ret;
     }
 
+    void Connection::enableTimestamps()
+    {
+        int on = 1;
+        if (::setsockopt(connfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1) {
+            perror("setsockopt");
+        }
+        trace.timestamping = true;
+    }
+
+    bool Connection::sendTraced(const char *src, size_t srcSize, size_t *sent)
+    {
+        TraceHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = TRACE_MAGIC;
+
+        uint64_t now = clockNow(CLOCK_MONOTONIC);
+        if (trace.pending) {
+            // First message after a sampled request is taken as its reply
+            header.flags = TRACE_REPLY;
+            header.id = trace.id;
+            header.sendTime = trace.sendTime;
+            header.requestTransit = trace.requestTransit;
+            header.requestWakeup = trace.requestWakeup;
+            header.processing = traceDuration(trace.receiveTime, now);
+            trace.pending = false;
+        }
+        else if (trace.requester && (header.id = Trace::sample()) != 0) {
+            // Only requesters sample; a responder's sends are replies
+            header.flags = TRACE_REQUEST;
+            header.sendTime = now;
+        }
+        else {
+            // Unsampled traffic goes out as is, so a peer that doesn't
+            // trace only ever sees headers on sampled requests
+            ssize_t result = ::send(connfd, src, srcSize, 0);
+            if (result < 0) return false;
+
+            *sent = result;
+            return true;
+        }
+
+        header.check = traceCheck(header);
+
+        struct iovec iov[2];
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = (void *)src;
+        iov[1].iov_len = srcSize;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+
+        ssize_t result = ::sendmsg(connfd, &msg, 0);
+        if (result < 0) return false;
+
+        *sent = (size_t)result > sizeof(header) ? result - sizeof(header) : 0;
+        return true;
+    }
+
+    bool Connection::recvTraced(char *dst, size_t dstSize, int flags, size_t *received,
+                                bool *hasHeader)
+    {
+        if (!trace.timestamping) enableTimestamps();
+
+        TraceHeader header;
+        struct iovec iov[2];
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+        iov[1].iov_base = dst;
+        iov[1].iov_len = dstSize;
+
+        char control[CMSG_SPACE(sizeof(struct timespec))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // MSG_TRUNC makes the result the real length of the message, which
+        // tells truncation apart whether or not it carries a header
+        ssize_t result = ::recvmsg(connfd, &msg, flags | MSG_TRUNC);
+        if (result < 0) return false;
+
+        uint64_t now = clockNow(CLOCK_MONOTONIC);
+
+        if (result == 0) {
+            *received = 0;
+            if (!(flags & MSG_PEEK)) truncated = false;
+            if (hasHeader) *hasHeader = false;
+            return true;
+        }
+
+        size_t length = result;
+        bool traced = length >= sizeof(header) && isTraceHeader(header);
+        if (hasHeader) *hasHeader = traced;
+
+        if (!traced) {
+            // The peer isn't tracing or didn't sample this message, and the
+            // start of its payload landed in the header; move it back in
+            // front of the rest
+            size_t copied = std::min(length, sizeof(header) + dstSize);
+            size_t head = std::min(copied, sizeof(header));
+            size_t rest = copied - head;
+            size_t moved = std::min(rest, dstSize > head ? dstSize - head : 0);
+            memmove(dst + head, dst, moved);
+            memcpy(dst, &header, std::min(head, dstSize));
+            *received = std::min(length, dstSize);
+            if (!(flags & MSG_PEEK)) truncated = length > dstSize;
+            return true;
+        }
+
+        *received = std::min(length - sizeof(header), dstSize);
+        if (!(flags & MSG_PEEK)) truncated = length - sizeof(header) > dstSize;
+        if (flags & MSG_PEEK) return true;
+
+        // The kernel stamps messages with CLOCK_REALTIME when it queues them
+        uint64_t kernelTime = now;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                uint64_t stamp = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+                uint64_t age = clockNow(CLOCK_REALTIME) - stamp;
+                kernelTime = age < now ? now - age : now;
+            }
+        }
+
+        if (header.flags & TRACE_REQUEST) {
+            trace.pending = true;
+            trace.id = header.id;
+            trace.sendTime = header.sendTime;
+            trace.requestTransit = traceDuration(header.sendTime, kernelTime);
+            trace.requestWakeup = traceDuration(kernelTime, now);
+            trace.receiveTime = now;
+        }
+        else if (header.flags & TRACE_REPLY) {
+            Trace::record(id, header, kernelTime, now);
+        }
+
+        return true;
+    }
+
     bool Connection::isInvalid()
     {
         return connfd < 0;
     }
 
-    Client::Client(std::string name) : name(name) { }
-
     bool Client::sendrecv(char *dst, size_t dstSize, const char *src, size_t srcSize,
-                          size_t *bytesReceived)
+                          size_t *bytesReceived, bool useCache)
     {
+        ResponseCache *cache = useCache ? this->cache.get() : NULL;
+        uint64_t generation = 0;
+        if (cache && cache->lookup(src, srcSize, dst, dstSize, bytesReceived, &generation))
+            return true;
+
         Connection connection = connect();
         if (connection.isInvalid()) return false;
 
         bool success = connection.send(src, srcSize, NULL);
         if (!success) return false;
 
-        success = connection.recv(dst, dstSize, bytesReceived);
+        size_t received = 0;
+        success = connection.recv(dst, dstSize, &received);
         if (!success) return false;
 
+        if (bytesReceived) *bytesReceived = received;
+        // Only whole replies are cached; a later call with a larger buffer
+        // must still get all of it. Nothing received means the server
+        // closed without answering, which isn't a reply either.
+        if (cache && received > 0 && !connection.isTruncated())
+            cache->store(src, srcSize, dst, received, generation);
+
         return true;
     }
 
     Connection Client::connect()
     {
-        int s, t, len;
-        struct sockaddr_un remote;
+        size_t count = endpoint.addresses.size();
+        if (count == 0) return Connection(-1);
 
-        if ((s = ::socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
-            perror("socket");
-            return Connection(-1);
-        }
+        // Spread connects over the listeners, falling back to the others
+        // when one doesn't answer
+        unsigned first = nextListener.fetch_add(1, std::memory_order_relaxed);
+        for (size_t n = 0; n < count; n++) {
+            const Endpoint::Address &address = endpoint.addresses[(first + n) % count];
+            int s;
 
-        std::stringstream ss;
-        ss << "/tmp/" << name;
-        std::string sockpath = ss.str();
-
-        remote.sun_family = AF_UNIX;
-        strcpy(remote.sun_path, sockpath.c_str());
-        len = strlen(remote.sun_path) + sizeof(remote.sun_family);
-        if (::connect(s, (struct sockaddr *)&remote, len) == -1) {
-            perror("connect");
+            if ((s = ::socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+                perror("socket");
+                return Connection(-1);
+            }
+
+            if (::connect(s, (const struct sockaddr *)&address.addr, address.len) == 0) {
+                Connection connection(s);
+                connection.trace.requester = true;
+                return connection;
+            }
+
+            if (n == count - 1)
+                perror("connect");
             close(s);
-            return Connection(-1);
         }
-        return Connection(s);
+        return Connection(-1);
     }
 
 #else
 
+    Endpoint::Endpoint(std::string name, Namespace space, unsigned listeners)
+        : name(name), space(space), listeners(1) { }
+    bool Endpoint::isInvalid() const
+    {
+        return true;
+    }
+
     Server::Server() { }
-    void Server::init(std::string name) { }
+    void Server::init(const Endpoint &endpoint, int backlog) { }
     Connection Server::accept()
     {
         return Connection();
     }
 
     Connection::Connection() { }
+    Connection::Connection(Connection &&other)
+        : id(other.id), stats(other.stats), truncated(other.truncated) { }
+    Connection& Connection::operator=(Connection &&other)
+    {
+        id = other.id;
+        stats = other.stats;
+        truncated = other.truncated;
+        return *this;
+    }
     Connection::~Connection() { }
     bool Connection::send(const char *src, size_t srcSize, size_t *bytesSent)
     {
@@ -353,11 +1057,14 @@ namespace Ipc {
     {
         return true;
     }
-
-    Client::Client(std::string name) : name(name) { }
+    void Connection::tune() { }
+    Connection::Stats Connection::getStats()
+    {
+        return stats;
+    }
 
     bool Client::sendrecv(char *dst, size_t dstSize, const char *src, size_t srcSize,
-                          size_t *bytesReceived)
+                          size_t *bytesReceived, bool useCache)
     {
         return false;
     }
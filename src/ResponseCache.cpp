@@ -0,0 +1,330 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux) || defined(__linux__) || defined(linux)
+#include <errno.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "ResponseCache.hpp"
+
+namespace Ipc {
+
+    // Rough per entry cost of the list node, index node and string headers
+    const size_t ENTRY_OVERHEAD = 128;
+
+    ResponseCache::ResponseCache(const Endpoint &endpoint, const CacheOptions &options)
+        : channel(endpoint.getChannel(INVALIDATION_SUFFIX)), options(options), bytes(0), generation(0), channelfd(-1)
+    {
+        memset(&stats, 0, sizeof(stats));
+        // Subscribe before anything gets cached so no invalidation is missed
+        subscribe(Clock::now());
+    }
+
+    ResponseCache::~ResponseCache()
+    {
+        unsubscribe();
+    }
+
+    size_t ResponseCache::entrySize(const Entry &entry)
+    {
+        // The request is stored twice, in the entry and as the index key
+        return 2 * entry.request.size() + entry.reply.size() + ENTRY_OVERHEAD;
+    }
+
+    bool ResponseCache::lookup(const char *request, size_t requestSize,
+                               char *dst, size_t dstSize, size_t *bytesReceived,
+                               uint64_t *generation)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+
+        poll(now);
+        *generation = this->generation;
+
+        auto it = index.find(std::string(request, requestSize));
+        if (it == index.end()) {
+            stats.misses++;
+            return false;
+        }
+
+        EntryList::iterator entry = it->second;
+        if (entry->expires <= now) {
+            erase(entry);
+            stats.expirations++;
+            stats.misses++;
+            return false;
+        }
+
+        entries.splice(entries.begin(), entries, entry);
+
+        size_t size = std::min(dstSize, entry->reply.size());
+        memcpy(dst, entry->reply.data(), size);
+        if (bytesReceived) *bytesReceived = size;
+        stats.hits++;
+        return true;
+    }
+
+    void ResponseCache::store(const char *request, size_t requestSize,
+                              const char *reply, size_t replySize, uint64_t generation)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+
+        poll(now);
+        if (generation != this->generation) return;
+
+        Entry entry;
+        entry.request.assign(request, requestSize);
+        entry.reply.assign(reply, replySize);
+
+        unsigned lifetimeMs = options.ttlMs;
+        if (channelfd < 0) lifetimeMs = std::min(lifetimeMs, options.maxStalenessMs);
+        entry.expires = now + std::chrono::milliseconds(lifetimeMs);
+
+        size_t size = entrySize(entry);
+        if (size > options.maxBytes) return;
+
+        auto it = index.find(entry.request);
+        if (it != index.end()) erase(it->second);
+
+        while (bytes + size > options.maxBytes) {
+            erase(std::prev(entries.end()));
+            stats.evictions++;
+        }
+
+        entries.push_front(std::move(entry));
+        index[entries.front().request] = entries.begin();
+        bytes += size;
+    }
+
+    CacheStats ResponseCache::getStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        CacheStats current = stats;
+        current.entries = entries.size();
+        current.bytes = bytes;
+        uint64_t lookups = stats.hits + stats.misses;
+        current.hitRatio = lookups ? (double)stats.hits / lookups : 0;
+        current.subscribed = channelfd >= 0;
+        return current;
+    }
+
+    void ResponseCache::erase(EntryList::iterator entry)
+    {
+        bytes -= entrySize(*entry);
+        index.erase(entry->request);
+        entries.erase(entry);
+    }
+
+    void ResponseCache::clear()
+    {
+        entries.clear();
+        index.clear();
+        bytes = 0;
+        generation++;
+    }
+
+#if defined(__linux) || defined(__linux__) || defined(linux)
+
+    void ResponseCache::subscribe(Clock::time_point now)
+    {
+        lastSubscribe = now;
+
+        if (channel.isInvalid()) return;
+
+        int s;
+        if ((s = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+            perror("socket");
+            return;
+        }
+
+        // Failing is normal when the server publishes no invalidations
+        const Endpoint::Address &address = channel.addresses[0];
+        if (::connect(s, (const struct sockaddr *)&address.addr, address.len) == -1) {
+            ::close(s);
+            return;
+        }
+        channelfd = s;
+    }
+
+    void ResponseCache::unsubscribe()
+    {
+        if (channelfd >= 0) {
+            ::close(channelfd);
+            channelfd = -1;
+        }
+    }
+
+    void ResponseCache::poll(Clock::time_point now)
+    {
+        if (channelfd < 0) {
+            if (now - lastSubscribe >= std::chrono::milliseconds(options.maxStalenessMs))
+                subscribe(now);
+            return;
+        }
+
+        for (;;) {
+            ssize_t size = ::recv(channelfd, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+            if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+            if (size <= 0) {
+                // The server went away; invalidations may have been lost
+                unsubscribe();
+                clear();
+                break;
+            }
+
+            std::string message(size, '\0');
+            if (::recv(channelfd, &message[0], size, MSG_DONTWAIT) != size) {
+                unsubscribe();
+                clear();
+                break;
+            }
+
+            stats.invalidations++;
+            generation++;
+
+            if (message[0] == INVALIDATE_ALL) {
+                clear();
+            }
+            else {
+                auto it = index.find(message.substr(1));
+                if (it != index.end()) erase(it->second);
+            }
+        }
+    }
+
+    CacheInvalidator::CacheInvalidator() : listenfd(-1) { }
+
+    CacheInvalidator::~CacheInvalidator()
+    {
+        for (int fd : subscribers)
+            ::close(fd);
+        if (listenfd >= 0)
+            ::close(listenfd);
+    }
+
+    void CacheInvalidator::init(const Endpoint &endpoint)
+    {
+        Endpoint channel = endpoint.getChannel(INVALIDATION_SUFFIX);
+        if (channel.isInvalid()) return;
+
+        if ((listenfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+            perror("socket");
+            return;
+        }
+
+        const Endpoint::Address &address = channel.addresses[0];
+        if (channel.getNamespace() == Endpoint::Filesystem)
+            unlink(address.addr.sun_path);
+        if (::bind(listenfd, (const struct sockaddr *)&address.addr, address.len) == -1) {
+            perror("bind");
+        }
+
+        if (::listen(listenfd, SOMAXCONN) == -1) {
+            perror("listen");
+        }
+    }
+
+    void CacheInvalidator::invalidate(const char *request, size_t requestSize)
+    {
+        publish(INVALIDATE_REQUEST, request, requestSize);
+    }
+
+    void CacheInvalidator::invalidateAll()
+    {
+        publish(INVALIDATE_ALL, NULL, 0);
+    }
+
+    size_t CacheInvalidator::getSubscriberCount()
+    {
+        int fd;
+        while (listenfd >= 0 &&
+               (fd = ::accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            subscribers.push_back(fd);
+        }
+        return subscribers.size();
+    }
+
+    void CacheInvalidator::publish(char op, const char *request, size_t requestSize)
+    {
+        // Pick up clients that subscribed since the last call
+        getSubscriberCount();
+
+        struct iovec iov[2];
+        iov[0].iov_base = &op;
+        iov[0].iov_len = 1;
+        iov[1].iov_base = (void *)request;
+        iov[1].iov_len = requestSize;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+
+        // A subscriber that can't take the message right away is dropped;
+        // it flushes its cache when it sees the channel close
+        for (auto it = subscribers.begin(); it != subscribers.end();) {
+            if (::sendmsg(*it, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                ::close(*it);
+                it = subscribers.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+#else
+
+    // Without an invalidation channel cached answers live at most
+    // maxStalenessMs
+    void ResponseCache::subscribe(Clock::time_point now) { }
+    void ResponseCache::unsubscribe() { }
+    void ResponseCache::poll(Clock::time_point now) { }
+
+    CacheInvalidator::CacheInvalidator() { }
+    CacheInvalidator::~CacheInvalidator() { }
+    void CacheInvalidator::init(const Endpoint &endpoint) { }
+    void CacheInvalidator::invalidate(const char *request, size_t requestSize) { }
+    void CacheInvalidator::invalidateAll() { }
+    size_t CacheInvalidator::getSubscriberCount()
+    {
+        return 0;
+    }
+    void CacheInvalidator::publish(char op, const char *request, size_t requestSize) { }
+
+#endif
+
+}; // namespace Ipc
@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Ipc.hpp"
+
+namespace Ipc {
+
+    // Invalidation channel messages are one op byte followed by the request
+    const char INVALIDATE_REQUEST = 0;
+    const char INVALIDATE_ALL = 1;
+
+    // Invalidations travel over an endpoint next to the server's
+    const char INVALIDATION_SUFFIX[] = ".invalidate";
+
+    // LRU cache behind Client::sendrecv()
+    class ResponseCache {
+        public:
+            ResponseCache(const Endpoint &endpoint, const CacheOptions &options);
+            ~ResponseCache();
+
+            // On a miss, generation receives a token to hand to store() so
+            // that a reply overtaken by an invalidation isn't cached
+            bool lookup(const char *request, size_t requestSize,
+                        char *dst, size_t dstSize, size_t *bytesReceived,
+                        uint64_t *generation);
+            void store(const char *request, size_t requestSize,
+                       const char *reply, size_t replySize, uint64_t generation);
+            CacheStats getStats();
+
+        private:
+            typedef std::chrono::steady_clock Clock;
+
+            struct Entry {
+                std::string request;
+                std::string reply;
+                Clock::time_point expires;
+            };
+
+            typedef std::list<Entry> EntryList;
+
+            static size_t entrySize(const Entry &entry);
+
+            void poll(Clock::time_point now);
+            void subscribe(Clock::time_point now);
+            void unsubscribe();
+            void erase(EntryList::iterator entry);
+            void clear();
+
+            Endpoint channel;
+            CacheOptions options;
+
+            std::mutex mutex;
+            EntryList entries;              // most recently used first
+            std::unordered_map<std::string, EntryList::iterator> index;
+            size_t bytes;
+            uint64_t generation;
+
+            int channelfd;
+            Clock::time_point lastSubscribe;
+
+            CacheStats stats;
+    };
+
+}; // namespace Ipc
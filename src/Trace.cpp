@@ -0,0 +1,216 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Gerald Young (Yoyobuae)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux) || defined(__linux__) || defined(linux)
+#include <unistd.h>
+#endif
+
+#include "Trace.hpp"
+
+namespace Ipc {
+
+    std::atomic<bool> Trace::enabled(false);
+
+    struct TraceSample {
+        uint64_t connectionId;
+        uint32_t id;
+        uint64_t sendTime;
+        uint64_t durations[Trace::StageCount];
+    };
+
+    static std::mutex traceMutex;
+    static TraceOptions traceOptions;
+    static std::atomic<unsigned> traceSampleEvery(64);
+    static std::atomic<uint32_t> traceCounter(0);
+    static Trace::Histogram histograms[Trace::StageCount];
+    static std::vector<TraceSample> samples;
+    static size_t nextSample = 0;
+
+    static const char *stageNames[Trace::StageCount] = {
+        "request transit",
+        "request wakeup",
+        "processing",
+        "reply transit",
+        "reply wakeup",
+        "round trip",
+    };
+
+    void Trace::enable(const TraceOptions &options)
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceOptions = options;
+        traceSampleEvery.store(options.sampleEvery ? options.sampleEvery : 1,
+                               std::memory_order_relaxed);
+        samples.clear();
+        samples.reserve(options.maxEvents);
+        nextSample = 0;
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    void Trace::disable()
+    {
+        enabled.store(false, std::memory_order_relaxed);
+    }
+
+    void Trace::reset()
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        memset(histograms, 0, sizeof(histograms));
+        samples.clear();
+        nextSample = 0;
+    }
+
+    const char *Trace::getStageName(Stage stage)
+    {
+        return stage < StageCount ? stageNames[stage] : "";
+    }
+
+    Trace::Histogram Trace::getHistogram(Stage stage)
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        if (stage >= StageCount) {
+            Histogram empty = {};
+            return empty;
+        }
+        return histograms[stage];
+    }
+
+    uint64_t Trace::getPercentile(Stage stage, double fraction)
+    {
+        Histogram histogram = getHistogram(stage);
+        if (histogram.count == 0) return 0;
+
+        uint64_t target = std::max<uint64_t>(1, fraction * histogram.count);
+        uint64_t seen = 0;
+        for (int i = 0; i < 64; i++) {
+            seen += histogram.buckets[i];
+            if (seen >= target)
+                return std::min<uint64_t>(histogram.maxNs, (i < 63) ? (2ull << i) - 1 : UINT64_MAX);
+        }
+        return histogram.maxNs;
+    }
+
+    uint32_t Trace::sample()
+    {
+        uint32_t count = traceCounter.fetch_add(1, std::memory_order_relaxed);
+        if (count % traceSampleEvery.load(std::memory_order_relaxed) != 0) return 0;
+        return (count / traceSampleEvery.load(std::memory_order_relaxed)) + 1;
+    }
+
+    static void addToHistogram(Trace::Histogram &histogram, uint64_t ns)
+    {
+        int bucket = 0;
+        while (bucket < 63 && (ns >> (bucket + 1)) != 0) bucket++;
+
+        histogram.count++;
+        histogram.totalNs += ns;
+        histogram.maxNs = std::max(histogram.maxNs, ns);
+        histogram.buckets[bucket]++;
+    }
+
+    void Trace::record(uint64_t connectionId, const TraceHeader &header,
+                       uint64_t replyKernelTime, uint64_t replyReceiveTime)
+    {
+        TraceSample sample;
+        sample.connectionId = connectionId;
+        sample.id = header.id;
+        sample.sendTime = header.sendTime;
+
+        uint64_t replySendTime = header.sendTime + header.requestTransit +
+                                 header.requestWakeup + header.processing;
+        replyKernelTime = std::min(std::max(replyKernelTime, replySendTime), replyReceiveTime);
+
+        sample.durations[RequestTransit] = header.requestTransit;
+        sample.durations[RequestWakeup] = header.requestWakeup;
+        sample.durations[Processing] = header.processing;
+        sample.durations[ReplyTransit] = replyKernelTime - replySendTime;
+        sample.durations[ReplyWakeup] = replyReceiveTime - replyKernelTime;
+        sample.durations[RoundTrip] = replyReceiveTime > header.sendTime ?
+                                      replyReceiveTime - header.sendTime : 0;
+
+        std::lock_guard<std::mutex> lock(traceMutex);
+        for (int stage = 0; stage < StageCount; stage++)
+            addToHistogram(histograms[stage], sample.durations[stage]);
+
+        if (traceOptions.maxEvents == 0) return;
+        if (samples.size() < traceOptions.maxEvents) {
+            samples.push_back(sample);
+        }
+        else {
+            samples[nextSample] = sample;
+            nextSample = (nextSample + 1) % samples.size();
+        }
+    }
+
+    bool Trace::writeChromeTrace(const std::string &path)
+    {
+        std::ofstream out(path.c_str());
+        if (!out) return false;
+
+#if defined(__linux) || defined(__linux__) || defined(linux)
+        long pid = getpid();
+#else
+        long pid = 0;
+#endif
+
+        std::lock_guard<std::mutex> lock(traceMutex);
+
+        // Oldest sample first once the buffer has wrapped
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        out.precision(3);
+        out << std::fixed;
+        bool first = true;
+        for (size_t n = 0; n < samples.size(); n++) {
+            const TraceSample &sample = samples[(nextSample + n) % samples.size()];
+
+            // Stages run back to back, except the round trip which spans them
+            uint64_t start = sample.sendTime;
+            for (int stage = 0; stage < StageCount; stage++) {
+                uint64_t stageStart = stage == RoundTrip ? sample.sendTime : start;
+
+                if (!first) out << ",";
+                first = false;
+                out << "{\"name\":\"" << stageNames[stage] << "\",\"cat\":\"ipc\",\"ph\":\"X\""
+                    << ",\"ts\":" << stageStart / 1000.0
+                    << ",\"dur\":" << sample.durations[stage] / 1000.0
+                    << ",\"pid\":" << pid
+                    << ",\"tid\":" << sample.connectionId
+                    << ",\"args\":{\"id\":" << sample.id << "}}";
+
+                if (stage != RoundTrip) start += sample.durations[stage];
+            }
+        }
+        out << "]}" << std::endl;
+
+        return out.good();
+    }
+
+}; // namespace Ipc
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Ipc.hpp"
+
+using namespace std::chrono_literals;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSERT_THROW(condition)                                     \
+{                                                                   \
+  if( !( condition ) )                                              \
+  {                                                                 \
+    throw std::runtime_error(   std::string( __FILE__ )             \
+                              + std::string( ":" )                  \
+                              + std::to_string( __LINE__ )          \
+                              + std::string( " in " )               \
+                              + std::string( __PRETTY_FUNCTION__ )  \
+                              + std::string( ": Assert failed: " )  \
+                              + std::string( #condition )           \
+    );                                                              \
+  }                                                                 \
+}
+
+#define GET_MESSAGE "get"
+#define BUMP_MESSAGE "bump"
+#define PROBE_MESSAGE "Probe"
+#define CLOSE_MESSAGE "close"
+#define QUIT_MESSAGE "quit"
+#define BUF_SIZE 20
+
+int main(int, char **)
+{
+    int pid;
+
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        ASSERT_THROW(false);
+    }
+    else if (pid > 0) {
+        // Parent process
+        Ipc::Server server;
+        server.init("IpcCacheTest");
+
+        Ipc::CacheInvalidator invalidator;
+        invalidator.init("IpcCacheTest");
+
+        int version = 1;
+        int requests = 0;
+        int closes = 0;
+        bool quit = false;
+
+        while (!quit) {
+            Ipc::Connection connection = server.accept();
+            ASSERT_THROW(!connection.isInvalid());
+
+            char buffer[BUF_SIZE];
+            size_t bytesReceived = 0;
+            ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+            requests++;
+
+            std::cout << "Server: Received " << buffer << std::endl;
+            std::cout.flush();
+
+            std::string reply = "ok";
+            if (strcmp(buffer, GET_MESSAGE) == 0) {
+                reply = "v" + std::to_string(version);
+            }
+            else if (strcmp(buffer, BUMP_MESSAGE) == 0) {
+                version++;
+                invalidator.invalidate(GET_MESSAGE, strlen(GET_MESSAGE) + 1);
+                ASSERT_THROW(invalidator.getSubscriberCount() == 1);
+            }
+            else if (strcmp(buffer, CLOSE_MESSAGE) == 0 && closes++ == 0) {
+                // Hang up without answering the first time
+                continue;
+            }
+            else if (strcmp(buffer, QUIT_MESSAGE) == 0) {
+                quit = true;
+            }
+
+            ASSERT_THROW(connection.send(reply.c_str(), reply.size() + 1));
+        }
+
+        // The second get is answered from the client's cache, the
+        // truncated probe reply and the missing close reply aren't
+        ASSERT_THROW(requests == 8);
+
+        int status = 0;
+        int waitedpid = wait(&status);
+        ASSERT_THROW(waitedpid == pid);
+        ASSERT_THROW(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    else {
+        // Child process
+        std::this_thread::sleep_for(100ms);
+
+        Ipc::Client client("IpcCacheTest");
+        client.enableCache();
+
+        char buffer[BUF_SIZE];
+        size_t bytesReceived = 0;
+
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, GET_MESSAGE, strlen(GET_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(strcmp(buffer, "v1") == 0);
+
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, GET_MESSAGE, strlen(GET_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(strcmp(buffer, "v1") == 0);
+        ASSERT_THROW(bytesReceived == 3);
+
+        // Requests that change state go past the cache
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, BUMP_MESSAGE, strlen(BUMP_MESSAGE) + 1, &bytesReceived, false));
+
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, GET_MESSAGE, strlen(GET_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(strcmp(buffer, "v2") == 0);
+
+        // A reply cut short by a small buffer must not be cached
+        ASSERT_THROW(client.sendrecv(buffer, 1, PROBE_MESSAGE, strlen(PROBE_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(bytesReceived == 1);
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, PROBE_MESSAGE, strlen(PROBE_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(bytesReceived == 3 && strcmp(buffer, "ok") == 0);
+
+        // A server hanging up without a reply isn't an empty reply to cache
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, CLOSE_MESSAGE, strlen(CLOSE_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(bytesReceived == 0);
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, CLOSE_MESSAGE, strlen(CLOSE_MESSAGE) + 1, &bytesReceived));
+        ASSERT_THROW(bytesReceived == 3 && strcmp(buffer, "ok") == 0);
+
+        ASSERT_THROW(client.sendrecv(buffer, BUF_SIZE, QUIT_MESSAGE, strlen(QUIT_MESSAGE) + 1, &bytesReceived, false));
+
+        Ipc::CacheStats stats = client.getCacheStats();
+
+        std::cout
+            << "Client: " << stats.hits << " hits, " << stats.misses << " misses, "
+            << stats.invalidations << " invalidations, hit ratio "
+            << stats.hitRatio << std::endl;
+
+        ASSERT_THROW(stats.subscribed);
+        ASSERT_THROW(stats.hits == 1);
+        ASSERT_THROW(stats.misses == 6);
+        ASSERT_THROW(stats.invalidations == 1);
+        // get, probe and close; bump and quit never went through the cache
+        ASSERT_THROW(stats.entries == 3);
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+};
+#endif
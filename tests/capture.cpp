@@ -0,0 +1,171 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Capture.hpp"
+#include "Ipc.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSERT_THROW(condition)                                     \
+{                                                                   \
+  if( !( condition ) )                                              \
+  {                                                                 \
+    throw std::runtime_error(   std::string( __FILE__ )             \
+                              + std::string( ":" )                  \
+                              + std::to_string( __LINE__ )          \
+                              + std::string( " in " )               \
+                              + std::string( __PRETTY_FUNCTION__ )  \
+                              + std::string( ": Assert failed: " )  \
+                              + std::string( #condition )           \
+    );                                                              \
+  }                                                                 \
+}
+
+#define CAPTURE_PATH "/tmp/IpcCaptureTest"
+#define CLIENT_MESSAGE "Hello server"
+#define SERVER_MESSAGE "Hi client"
+#define BUF_SIZE 20
+#define ROUNDS 100
+#define REPLAY_SERVER "IpcReplayTest"
+
+// Runs ipc_replay over the capture against an echo server. Replaying the
+// "sent" side acts out both ends of every round: the client connection
+// expects its echo, the server connection only sends and closes.
+static void replay(const char *replayPath)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    Ipc::Server server;
+    server.init(REPLAY_SERVER);
+
+    pid_t pid = fork();
+    ASSERT_THROW(pid >= 0);
+    if (pid == 0) {
+        execl(replayPath, replayPath, CAPTURE_PATH, REPLAY_SERVER, "0", "sent", (char *)NULL);
+        perror("execl");
+        _exit(1);
+    }
+
+    for (int i = 0; i < 2 * ROUNDS; i++) {
+        Ipc::Connection connection = server.accept();
+        ASSERT_THROW(!connection.isInvalid());
+
+        char buffer[BUF_SIZE];
+        size_t bytesReceived = 0;
+        while (connection.recv(buffer, BUF_SIZE, &bytesReceived) && bytesReceived > 0) {
+            if (!connection.send(buffer, bytesReceived)) break;
+        }
+    }
+
+    int status = 0;
+    ASSERT_THROW(waitpid(pid, &status, 0) == pid);
+    ASSERT_THROW(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    // Small segments so the writer has to rotate a few times
+    Ipc::CaptureOptions options;
+    options.segmentSize = 4096;
+    options.ringSize = 64 * 1024;
+    ASSERT_THROW(Ipc::Capture::start(CAPTURE_PATH, options));
+
+    Ipc::Server server;
+    server.init("IpcCaptureTest");
+    Ipc::Client client("IpcCaptureTest");
+
+    uint64_t clientId = 0;
+    uint64_t serverId = 0;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        // Connecting completes from the listen backlog before accept
+        Ipc::Connection clientConnection = client.connect();
+        ASSERT_THROW(!clientConnection.isInvalid());
+        Ipc::Connection serverConnection = server.accept();
+        ASSERT_THROW(!serverConnection.isInvalid());
+
+        char buffer[BUF_SIZE];
+        size_t bytesReceived = 0;
+        ASSERT_THROW(clientConnection.send(CLIENT_MESSAGE, strlen(CLIENT_MESSAGE) + 1));
+        ASSERT_THROW(serverConnection.recv(buffer, BUF_SIZE, &bytesReceived));
+        ASSERT_THROW(serverConnection.send(SERVER_MESSAGE, strlen(SERVER_MESSAGE) + 1));
+        ASSERT_THROW(clientConnection.recv(buffer, BUF_SIZE, &bytesReceived));
+
+        if (i == 0) {
+            clientId = clientConnection.getId();
+            serverId = serverConnection.getId();
+            ASSERT_THROW(clientId != serverId);
+        }
+    }
+
+    Ipc::Capture::stop();
+
+    Ipc::Capture::Stats stats = Ipc::Capture::getStats();
+
+    std::cout
+        << "Capture: Recorded " << stats.recorded
+        << " messages (" << stats.dropped << " dropped) in "
+        << stats.segments << " segments" << std::endl;
+
+    ASSERT_THROW(stats.recorded == 4 * ROUNDS);
+    ASSERT_THROW(stats.dropped == 0);
+    ASSERT_THROW(stats.segments > 1);
+
+    Ipc::CaptureReader reader(CAPTURE_PATH);
+    Ipc::CaptureRecord record;
+    std::vector<char> payload;
+    uint64_t count = 0;
+    uint64_t lastTimestamp = 0;
+
+    while (reader.next(record, payload)) {
+        ASSERT_THROW(record.timestamp >= lastTimestamp);
+        lastTimestamp = record.timestamp;
+
+        // Every round is client send, server receive, server send, client receive
+        switch (count % 4) {
+            case 0:
+            case 3:
+                ASSERT_THROW(record.direction == ((count % 4) ? Ipc::CaptureRecord::Received
+                                                              : Ipc::CaptureRecord::Sent));
+                ASSERT_THROW(count >= 4 || record.connectionId == clientId);
+                break;
+            case 1:
+            case 2:
+                ASSERT_THROW(record.direction == ((count % 4) == 1 ? Ipc::CaptureRecord::Received
+                                                                   : Ipc::CaptureRecord::Sent));
+                ASSERT_THROW(count >= 4 || record.connectionId == serverId);
+                break;
+        }
+
+        const char *expected = (count % 4) < 2 ? CLIENT_MESSAGE : SERVER_MESSAGE;
+        ASSERT_THROW(record.size == strlen(expected) + 1);
+        ASSERT_THROW(strncmp(payload.data(), expected, BUF_SIZE) == 0);
+        count++;
+    }
+
+    ASSERT_THROW(count == stats.recorded);
+
+    if (argc > 1) replay(argv[1]);
+
+    for (unsigned segment = 0; segment < stats.segments; segment++) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s.%04u", CAPTURE_PATH, segment);
+        remove(name);
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+};
+#endif
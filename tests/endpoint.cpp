@@ -0,0 +1,178 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Ipc.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSERT_THROW(condition)                                     \
+{                                                                   \
+  if( !( condition ) )                                              \
+  {                                                                 \
+    throw std::runtime_error(   std::string( __FILE__ )             \
+                              + std::string( ":" )                  \
+                              + std::to_string( __LINE__ )          \
+                              + std::string( " in " )               \
+                              + std::string( __PRETTY_FUNCTION__ )  \
+                              + std::string( ": Assert failed: " )  \
+                              + std::string( #condition )           \
+    );                                                              \
+  }                                                                 \
+}
+
+#define CLIENT_MESSAGE "Hello server"
+#define BUF_SIZE 20
+#define LISTENERS 3
+#define LATENCY_ROUNDS 2000
+
+static void exchange(Ipc::Server &server, Ipc::Client &client, int count)
+{
+    // Connecting completes from the listen backlog before accept
+    std::vector<Ipc::Connection> clientConnections;
+    for (int i = 0; i < count; i++) {
+        clientConnections.push_back(client.connect());
+        ASSERT_THROW(!clientConnections.back().isInvalid());
+        ASSERT_THROW(clientConnections.back().send(CLIENT_MESSAGE, strlen(CLIENT_MESSAGE) + 1));
+    }
+
+    for (int i = 0; i < count; i++) {
+        Ipc::Connection connection = server.accept();
+        ASSERT_THROW(!connection.isInvalid());
+
+        char buffer[BUF_SIZE];
+        size_t bytesReceived = 0;
+        ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+        ASSERT_THROW(bytesReceived == (strlen(CLIENT_MESSAGE) + 1));
+        ASSERT_THROW(strncmp(buffer, CLIENT_MESSAGE, BUF_SIZE) == 0);
+    }
+}
+
+// Whether a socket is bound to the given abstract name
+static bool abstractBound(const std::string &name)
+{
+    std::ifstream sockets("/proc/net/unix");
+    std::string suffix = " @" + name;
+    std::string line;
+    while (std::getline(sockets, line)) {
+        if (line.size() >= suffix.size() &&
+            line.compare(line.size() - suffix.size(), std::string::npos, suffix) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Mean time for client.connect() to return, ipc_client style: one connect
+// at a time, accepted and closed before the next
+static double connectLatency(Ipc::Server &server, Ipc::Client &client)
+{
+    std::chrono::nanoseconds total(0);
+    for (int i = 0; i < LATENCY_ROUNDS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        Ipc::Connection clientConnection = client.connect();
+        total += std::chrono::steady_clock::now() - start;
+        ASSERT_THROW(!clientConnection.isInvalid());
+
+        Ipc::Connection serverConnection = server.accept();
+        ASSERT_THROW(!serverConnection.isInvalid());
+    }
+    return (double)total.count() / LATENCY_ROUNDS;
+}
+
+int main(int, char **)
+{
+    // A broken listener distribution would leave accept() waiting forever
+    alarm(30);
+
+    // Abstract endpoints leave nothing in the filesystem
+    Ipc::Endpoint abstract("IpcEndpointTest", Ipc::Endpoint::Abstract, LISTENERS);
+    ASSERT_THROW(!abstract.isInvalid());
+    ASSERT_THROW(abstract.getListenerCount() == LISTENERS);
+
+    Ipc::Server abstractServer;
+    abstractServer.init(abstract);
+    Ipc::Client abstractClient(abstract);
+    exchange(abstractServer, abstractClient, 2 * LISTENERS);
+
+    for (int i = 0; i < LISTENERS; i++) {
+        std::string listener = "IpcEndpointTest." + std::to_string(i);
+        ASSERT_THROW(abstractBound("ipc/" + listener));
+        ASSERT_THROW(access(("/tmp/" + listener).c_str(), F_OK) != 0);
+    }
+    std::cout << "Abstract endpoint: " << 2 * LISTENERS << " connections" << std::endl;
+
+    // Listener i of a multi-listener endpoint has the address of the
+    // single-listener endpoint "<name>.i", so each listener can be served
+    // on its own. Rotating connects give every one the same share; an
+    // uneven split leaves one of the accepts below waiting.
+    Ipc::Server spreadServers[LISTENERS];
+    for (int i = 0; i < LISTENERS; i++) {
+        spreadServers[i].init(Ipc::Endpoint("IpcSpreadTest." + std::to_string(i),
+                                            Ipc::Endpoint::Abstract));
+    }
+    Ipc::Client spreadClient(Ipc::Endpoint("IpcSpreadTest", Ipc::Endpoint::Abstract, LISTENERS));
+    std::vector<Ipc::Connection> spreadConnections;
+    for (int i = 0; i < 2 * LISTENERS; i++) {
+        spreadConnections.push_back(spreadClient.connect());
+        ASSERT_THROW(!spreadConnections.back().isInvalid());
+    }
+    for (int i = 0; i < LISTENERS; i++) {
+        for (int n = 0; n < 2; n++)
+            ASSERT_THROW(!spreadServers[i].accept().isInvalid());
+    }
+    std::cout << "Abstract endpoint: Connects spread evenly" << std::endl;
+
+    // Redundant filesystem listeners get one socket file each
+    Ipc::Endpoint filesystem("IpcEndpointTest", Ipc::Endpoint::Filesystem, 2);
+    Ipc::Server filesystemServer;
+    filesystemServer.init(filesystem);
+    Ipc::Client filesystemClient(filesystem);
+    exchange(filesystemServer, filesystemClient, 4);
+
+    ASSERT_THROW(access("/tmp/IpcEndpointTest.0", F_OK) == 0);
+    ASSERT_THROW(access("/tmp/IpcEndpointTest.1", F_OK) == 0);
+    unlink("/tmp/IpcEndpointTest.0");
+    unlink("/tmp/IpcEndpointTest.1");
+    std::cout << "Filesystem endpoint: 4 connections" << std::endl;
+
+    // One listener each, so only the namespace differs
+    Ipc::Endpoint latencyFilesystem("IpcLatencyTest");
+    Ipc::Server latencyFilesystemServer;
+    latencyFilesystemServer.init(latencyFilesystem);
+    Ipc::Client latencyFilesystemClient(latencyFilesystem);
+    double filesystemNs = connectLatency(latencyFilesystemServer, latencyFilesystemClient);
+    unlink("/tmp/IpcLatencyTest");
+
+    Ipc::Endpoint latencyAbstract("IpcLatencyTest", Ipc::Endpoint::Abstract);
+    Ipc::Server latencyAbstractServer;
+    latencyAbstractServer.init(latencyAbstract);
+    Ipc::Client latencyAbstractClient(latencyAbstract);
+    double abstractNs = connectLatency(latencyAbstractServer, latencyAbstractClient);
+
+    std::cout
+        << "Connect latency: filesystem " << filesystemNs << " ns, abstract "
+        << abstractNs << " ns" << std::endl;
+
+    // Names that don't fit in sun_path are refused up front, on both sides
+    Ipc::Endpoint tooLong(std::string(200, 'x'));
+    ASSERT_THROW(tooLong.isInvalid());
+    Ipc::Client tooLongClient(tooLong);
+    ASSERT_THROW(tooLongClient.connect().isInvalid());
+    Ipc::Server tooLongServer;
+    tooLongServer.init(tooLong);
+    ASSERT_THROW(tooLongServer.accept().isInvalid());
+
+    return 0;
+}
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Capture.hpp"
+#include "Ipc.hpp"
+
+// Replays the messages of a capture against a running server.
+//
+//   ipc_replay <capture> <server name> [speed] [sent|received]
+//
+// speed scales the original inter-message timing (2 replays twice as fast,
+// 0 replays as fast as possible). The direction selects which side of the
+// capture acts as the client: "sent" for a capture taken in the client,
+// "received" for one taken in the server. Each captured connection gets its
+// own connection to the server; whenever the capture shows a reply on the
+// same connection, the reply is waited for and its latency measured.
+
+#define BUF_SIZE (256 * 1024)
+
+struct Message {
+    uint64_t timestamp;
+    uint64_t connectionId;
+    bool request;
+    bool expectsReply;
+    bool lastOfConnection;
+    std::vector<char> payload;
+};
+
+static double percentile(std::vector<double> &values, double p)
+{
+    if (values.empty()) return 0;
+    size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0]
+                  << " <capture> <server name> [speed] [sent|received]" << std::endl;
+        return 1;
+    }
+
+    std::string capturePath = argv[1];
+    std::string name = argv[2];
+    double speed = argc > 3 ? atof(argv[3]) : 1.0;
+    uint8_t requestDirection = Ipc::CaptureRecord::Sent;
+    if (argc > 4 && strcmp(argv[4], "received") == 0)
+        requestDirection = Ipc::CaptureRecord::Received;
+
+    std::vector<Message> messages;
+    Ipc::CaptureReader reader(capturePath);
+    Ipc::CaptureRecord record;
+    std::vector<char> payload;
+    while (reader.next(record, payload)) {
+        Message message;
+        message.timestamp = record.timestamp;
+        message.connectionId = record.connectionId;
+        message.request = record.direction == requestDirection;
+        message.expectsReply = false;
+        message.lastOfConnection = false;
+        message.payload.swap(payload);
+        messages.push_back(std::move(message));
+    }
+
+    if (messages.empty()) {
+        std::cerr << "No messages in capture " << capturePath << std::endl;
+        return 1;
+    }
+
+    // Records from different threads can reach the capture slightly out of
+    // order; replay in timestamp order so the schedule never runs backwards
+    std::stable_sort(messages.begin(), messages.end(),
+                     [](const Message &a, const Message &b) {
+                         return a.timestamp < b.timestamp;
+                     });
+
+    // A request expects a reply if the next message on its connection goes
+    // the other way
+    std::map<uint64_t, size_t> lastIndex;
+    for (size_t i = 0; i < messages.size(); i++) {
+        auto it = lastIndex.find(messages[i].connectionId);
+        if (it != lastIndex.end()) {
+            Message &previous = messages[it->second];
+            previous.expectsReply = previous.request && !messages[i].request;
+        }
+        lastIndex[messages[i].connectionId] = i;
+    }
+    for (auto &entry : lastIndex)
+        messages[entry.second].lastOfConnection = true;
+
+    Ipc::Client client(name);
+    std::map<uint64_t, Ipc::Connection> connections;
+    std::vector<double> latencies;
+    std::vector<char> buffer(BUF_SIZE);
+    uint64_t sent = 0;
+    uint64_t failures = 0;
+    double maxLag = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t firstTimestamp = messages.front().timestamp;
+
+    for (size_t i = 0; i < messages.size(); i++) {
+        Message &message = messages[i];
+
+        if (message.request) {
+            if (speed > 0) {
+                auto due = start + std::chrono::nanoseconds(
+                    (uint64_t)((message.timestamp - firstTimestamp) / speed));
+                auto now = std::chrono::steady_clock::now();
+                if (due > now)
+                    std::this_thread::sleep_until(due);
+                else
+                    maxLag = std::max(maxLag,
+                        std::chrono::duration<double, std::milli>(now - due).count());
+            }
+
+            auto it = connections.find(message.connectionId);
+            if (it == connections.end()) {
+                it = connections.emplace(message.connectionId, client.connect()).first;
+            }
+            Ipc::Connection &connection = it->second;
+
+            auto sendTime = std::chrono::steady_clock::now();
+            if (!connection.send(message.payload.data(), message.payload.size())) {
+                failures++;
+            }
+            else {
+                sent++;
+                if (message.expectsReply) {
+                    size_t bytesReceived = 0;
+                    if (connection.recv(buffer.data(), buffer.size(), &bytesReceived) &&
+                        bytesReceived > 0) {
+                        latencies.push_back(std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - sendTime).count());
+                    }
+                    else {
+                        failures++;
+                    }
+                }
+            }
+        }
+
+        if (message.lastOfConnection)
+            connections.erase(message.connectionId);
+    }
+
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    double captured = (messages.back().timestamp - firstTimestamp) / 1e9;
+
+    std::cout
+        << "Replay: Sent " << sent << " requests in " << elapsed << " s"
+        << " (captured over " << captured << " s), "
+        << failures << " failures, max lag " << maxLag << " ms" << std::endl;
+    std::cout
+        << "Replay: " << latencies.size() << " replies, latency us"
+        << " p50 " << percentile(latencies, 0.50)
+        << " p90 " << percentile(latencies, 0.90)
+        << " p99 " << percentile(latencies, 0.99)
+        << " max " << percentile(latencies, 1.0) << std::endl;
+
+    return failures ? 1 : 0;
+}
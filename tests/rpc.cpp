@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Ipc.hpp"
+#include "Rpc.hpp"
+
+using namespace std::chrono_literals;
+
+struct AddRequest {
+    int32_t a;
+    int32_t b;
+};
+
+struct AddReply {
+    int32_t sum;
+};
+
+struct DivideRequest {
+    double dividend;
+    double divisor;
+};
+
+struct DivideReply {
+    double quotient;
+};
+
+static bool add(const AddRequest &request, AddReply &reply)
+{
+    reply.sum = request.a + request.b;
+    return true;
+}
+
+static bool divide(const DivideRequest &request, DivideReply &reply)
+{
+    if (request.divisor == 0) return false;
+    reply.quotient = request.dividend / request.divisor;
+    return true;
+}
+
+typedef Ipc::RpcMethod<1, AddRequest, AddReply, add> Add;
+typedef Ipc::RpcMethod<7, DivideRequest, DivideReply, divide> Divide;
+
+// Known to the client only
+typedef Ipc::RpcMethod<9, AddRequest, AddReply, add> Missing;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSERT_THROW(condition)                                     \
+{                                                                   \
+  if( !( condition ) )                                              \
+  {                                                                 \
+    throw std::runtime_error(   std::string( __FILE__ )             \
+                              + std::string( ":" )                  \
+                              + std::to_string( __LINE__ )          \
+                              + std::string( " in " )               \
+                              + std::string( __PRETTY_FUNCTION__ )  \
+                              + std::string( ": Assert failed: " )  \
+                              + std::string( #condition )           \
+    );                                                              \
+  }                                                                 \
+}
+
+int main(int, char **)
+{
+    int pid;
+
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        ASSERT_THROW(false);
+    }
+    else if (pid > 0) {
+        // Parent process
+        Ipc::Server server;
+        server.init("IpcRpcTest");
+
+        Ipc::RpcDispatcher<Add, Divide> dispatcher;
+
+        std::cout << "Server: Waiting for client to connect..." << std::endl;
+        std::cout.flush();
+
+        Ipc::Connection connection = server.accept();
+        ASSERT_THROW(!connection.isInvalid());
+
+        dispatcher.serveAll(connection);
+
+        Ipc::RpcDispatcher<Add, Divide>::MethodStats addStats = dispatcher.getStats(0);
+        Ipc::RpcDispatcher<Add, Divide>::MethodStats divideStats = dispatcher.getStats(1);
+
+        std::cout
+            << "Server: Add " << addStats.calls << " calls, "
+            << addStats.totalNs << " ns total; Divide " << divideStats.calls
+            << " calls, " << divideStats.failures << " failed" << std::endl;
+
+        ASSERT_THROW(addStats.id == 1 && addStats.calls == 100 && addStats.failures == 0);
+        ASSERT_THROW(divideStats.id == 7 && divideStats.calls == 2 && divideStats.failures == 1);
+        ASSERT_THROW(addStats.maxNs <= addStats.totalNs);
+
+        int waitedpid = wait(NULL);
+        ASSERT_THROW(waitedpid == pid);
+    }
+    else {
+        // Child process
+        std::this_thread::sleep_for(100ms);
+
+        Ipc::Client client("IpcRpcTest");
+        Ipc::Connection connection = client.connect();
+        ASSERT_THROW(!connection.isInvalid());
+
+        Ipc::RpcStatus status;
+        for (int32_t i = 0; i < 100; i++) {
+            AddRequest request = { i, 2 * i };
+            AddReply reply = {};
+            ASSERT_THROW(Ipc::rpcCall<Add>(connection, request, reply, &status));
+            ASSERT_THROW(status == Ipc::RpcOk);
+            ASSERT_THROW(reply.sum == 3 * i);
+        }
+
+        DivideRequest divideRequest = { 1.0, 4.0 };
+        DivideReply divideReply = {};
+        ASSERT_THROW(Ipc::rpcCall<Divide>(connection, divideRequest, divideReply, &status));
+        ASSERT_THROW(status == Ipc::RpcOk && divideReply.quotient == 0.25);
+
+        divideRequest.divisor = 0;
+        ASSERT_THROW(Ipc::rpcCall<Divide>(connection, divideRequest, divideReply, &status));
+        ASSERT_THROW(status == Ipc::RpcFailed);
+
+        AddRequest request = { 1, 1 };
+        AddReply reply = {};
+        ASSERT_THROW(Ipc::rpcCall<Missing>(connection, request, reply, &status));
+        ASSERT_THROW(status == Ipc::RpcUnknownMethod);
+
+        // A well formed Divide request with trailing bytes is longer than
+        // the server's buffer and must not be dispatched truncated
+        struct {
+            Ipc::RpcHeader header;
+            DivideRequest request;
+            char trailing[16];
+        } oversized = {};
+        oversized.header.method = Divide::id;
+        oversized.request = { 1.0, 2.0 };
+        ASSERT_THROW(connection.send(reinterpret_cast<const char *>(&oversized), sizeof(oversized)));
+        Ipc::RpcHeader replyHeader = {};
+        ASSERT_THROW(connection.recv(reinterpret_cast<char *>(&replyHeader), sizeof(replyHeader)));
+        ASSERT_THROW(replyHeader.status == Ipc::RpcBadRequest);
+
+        std::cout << "Client: All calls answered" << std::endl;
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,336 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Ipc.hpp"
+
+// Connection churn and many-client scalability stress test.
+//
+//   ipc_stress [max clients] [processes] [backlog] [listeners] [abstract]
+//
+// Runs rounds with a growing number of clients, up to max clients. In each
+// round the client processes connect all their clients as fast as they can,
+// send one echo request per connection with payload sizes cycling from 16
+// bytes to 64 KiB, then hold the connections idle while the server's memory
+// is measured, and finally disconnect them all at once. The server runs one
+// thread per connection. Passing "abstract" uses an abstract namespace
+// endpoint instead of a socket file in /tmp.
+//
+// A Unix socket listener with a full accept queue makes connect() wait
+// rather than fail, so accept queue overflows show up as stalled connects.
+
+using namespace std::chrono;
+
+#define STALL_US 1000
+
+static const size_t payloadSizes[] = { 16, 256, 4 * 1024, 64 * 1024 };
+
+struct RoundResult {
+    uint64_t connects;
+    uint64_t failures;
+    uint64_t stalls;
+    uint64_t echoFailures;
+    double stormSeconds;
+    uint64_t latencyCount;
+};
+
+static Ipc::Endpoint endpoint("IpcStress");
+static std::atomic<int> liveConnections(0);
+static std::atomic<bool> stopping(false);
+
+static long residentKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+static bool readAll(int fd, void *dst, size_t size)
+{
+    char *p = (char *)dst;
+    while (size) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void *src, size_t size)
+{
+    const char *p = (const char *)src;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> &values, double p)
+{
+    if (values.empty()) return 0;
+    size_t index = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void echo(Ipc::Connection connection)
+{
+    std::vector<char> buffer;
+    char first;
+
+    for (;;) {
+        // Size the buffer to the next message so idle connections hold no
+        // more memory than the library itself needs
+        size_t bytesReceived = 0;
+        size_t bytesAvailable = 0;
+        if (!connection.peek(&first, 1, &bytesReceived, &bytesAvailable) ||
+            bytesReceived == 0)
+            break;
+
+        buffer.resize(bytesAvailable);
+        if (!connection.recv(buffer.data(), buffer.size(), &bytesReceived) ||
+            bytesReceived == 0)
+            break;
+        if (!connection.send(buffer.data(), bytesReceived))
+            break;
+
+        std::vector<char>().swap(buffer);
+    }
+
+    liveConnections--;
+}
+
+static void acceptLoop(Ipc::Server *server)
+{
+    for (;;) {
+        Ipc::Connection connection = server->accept();
+        if (stopping) break;
+        if (connection.isInvalid()) continue;
+
+        liveConnections++;
+        std::thread(echo, std::move(connection)).detach();
+    }
+}
+
+static void runClients(int count, int resultfd, int releasefd)
+{
+    Ipc::Client client(endpoint);
+    std::vector<Ipc::Connection> connections;
+    connections.reserve(count);
+
+    RoundResult result = {};
+    std::vector<double> latencies;
+
+    auto stormStart = steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        auto start = steady_clock::now();
+        Ipc::Connection connection = client.connect();
+        double us = duration<double, std::micro>(steady_clock::now() - start).count();
+
+        if (connection.isInvalid()) {
+            result.failures++;
+            continue;
+        }
+        result.connects++;
+        if (us > STALL_US) result.stalls++;
+        connections.push_back(std::move(connection));
+    }
+    result.stormSeconds = duration<double>(steady_clock::now() - stormStart).count();
+
+    std::vector<char> payload(64 * 1024, 'x');
+    std::vector<char> reply(64 * 1024);
+    for (size_t i = 0; i < connections.size(); i++) {
+        size_t size = payloadSizes[(getpid() + i) % 4];
+        size_t bytesReceived = 0;
+
+        auto start = steady_clock::now();
+        if (!connections[i].send(payload.data(), size) ||
+            !connections[i].recv(reply.data(), reply.size(), &bytesReceived) ||
+            bytesReceived != size) {
+            result.echoFailures++;
+            continue;
+        }
+        latencies.push_back(duration<double, std::micro>(steady_clock::now() - start).count());
+    }
+
+    result.latencyCount = latencies.size();
+    writeAll(resultfd, &result, sizeof(result));
+    writeAll(resultfd, latencies.data(), latencies.size() * sizeof(double));
+
+    // Hold the connections idle until the server has been measured
+    char release;
+    readAll(releasefd, &release, 1);
+}
+
+int main(int argc, char **argv)
+{
+    int maxClients = argc > 1 ? atoi(argv[1]) : 1024;
+    int processes = argc > 2 ? atoi(argv[2]) : 8;
+    int backlog = argc > 3 ? atoi(argv[3]) : 5;
+    int listeners = argc > 4 ? atoi(argv[4]) : 1;
+    bool abstract = argc > 5 && strcmp(argv[5], "abstract") == 0;
+    if (maxClients < 1 || processes < 1 || listeners < 1) {
+        std::cerr << "usage: " << argv[0]
+                  << " [max clients] [processes] [backlog] [listeners] [abstract]" << std::endl;
+        return 1;
+    }
+
+    endpoint = Ipc::Endpoint("IpcStress",
+                             abstract ? Ipc::Endpoint::Abstract : Ipc::Endpoint::Filesystem,
+                             listeners);
+
+    // Every connection costs a descriptor on both ends
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Ipc::Server server;
+    server.init(endpoint, backlog);
+    std::thread acceptor(acceptLoop, &server);
+
+    std::cout
+        << "backlog " << backlog << ", " << listeners
+        << (abstract ? " abstract" : " filesystem") << " listeners, "
+        << processes << " client processes" << std::endl
+        << std::setw(8) << "clients" << std::setw(12) << "connects/s"
+        << std::setw(8) << "stalls" << std::setw(10) << "failures"
+        << std::setw(12) << "RSS/conn KB" << std::setw(10) << "p50 us"
+        << std::setw(10) << "p99 us" << std::setw(10) << "max us" << std::endl;
+
+    bool failed = false;
+    std::vector<int> rounds;
+    for (int clients = std::min(16, maxClients); clients < maxClients; clients *= 4)
+        rounds.push_back(clients);
+    rounds.push_back(maxClients);
+
+    for (int clients : rounds) {
+        int procs = std::min(processes, clients);
+        long baselineKb = residentKb();
+
+        int releasePipe[2];
+        if (pipe(releasePipe) == -1) {
+            perror("pipe");
+            return 1;
+        }
+
+        std::vector<int> resultfds;
+        std::vector<int> pids;
+        for (int p = 0; p < procs; p++) {
+            int resultPipe[2];
+            if (pipe(resultPipe) == -1) {
+                perror("pipe");
+                return 1;
+            }
+
+            int pid = fork();
+            if (pid == -1) {
+                perror("fork");
+                return 1;
+            }
+            if (pid == 0) {
+                close(resultPipe[0]);
+                close(releasePipe[1]);
+                int count = clients / procs + (p < clients % procs ? 1 : 0);
+                runClients(count, resultPipe[1], releasePipe[0]);
+                _exit(0);
+            }
+
+            close(resultPipe[1]);
+            resultfds.push_back(resultPipe[0]);
+            pids.push_back(pid);
+        }
+        close(releasePipe[0]);
+
+        RoundResult total = {};
+        double stormSeconds = 0;
+        std::vector<double> latencies;
+        for (int fd : resultfds) {
+            RoundResult result;
+            if (!readAll(fd, &result, sizeof(result))) {
+                failed = true;
+                close(fd);
+                continue;
+            }
+            std::vector<double> childLatencies(result.latencyCount);
+            readAll(fd, childLatencies.data(), childLatencies.size() * sizeof(double));
+            latencies.insert(latencies.end(), childLatencies.begin(), childLatencies.end());
+            close(fd);
+
+            total.connects += result.connects;
+            total.failures += result.failures;
+            total.stalls += result.stalls;
+            total.echoFailures += result.echoFailures;
+            stormSeconds = std::max(stormSeconds, result.stormSeconds);
+        }
+
+        // All clients are connected and idle now
+        auto deadline = steady_clock::now() + seconds(10);
+        while (liveConnections < (int)total.connects && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(milliseconds(1));
+        long loadedKb = residentKb();
+        int live = liveConnections;
+
+        std::vector<char> release(procs, 'r');
+        writeAll(releasePipe[1], release.data(), release.size());
+        close(releasePipe[1]);
+
+        for (int pid : pids) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = true;
+        }
+
+        // Let the server side of the disconnect storm finish
+        deadline = steady_clock::now() + seconds(10);
+        while (liveConnections > 0 && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(milliseconds(1));
+
+        double rssPerConnection = live ? (double)(loadedKb - baselineKb) / live : 0;
+
+        std::cout
+            << std::fixed << std::setprecision(1)
+            << std::setw(8) << clients
+            << std::setw(12) << (stormSeconds > 0 ? total.connects / stormSeconds : 0)
+            << std::setw(8) << total.stalls
+            << std::setw(10) << total.failures + total.echoFailures
+            << std::setw(12) << rssPerConnection
+            << std::setw(10) << percentile(latencies, 0.50)
+            << std::setw(10) << percentile(latencies, 0.99)
+            << std::setw(10) << percentile(latencies, 1.0) << std::endl;
+
+        if (total.failures || total.echoFailures || liveConnections > 0) failed = true;
+    }
+
+    // Wake the acceptor so it can see the stop flag
+    stopping = true;
+    Ipc::Client(endpoint).connect();
+    acceptor.join();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Ipc.hpp"
+#include "Trace.hpp"
+
+using namespace std::chrono_literals;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSERT_THROW(condition)                                     \
+{                                                                   \
+  if( !( condition ) )                                              \
+  {                                                                 \
+    throw std::runtime_error(   std::string( __FILE__ )             \
+                              + std::string( ":" )                  \
+                              + std::to_string( __LINE__ )          \
+                              + std::string( " in " )               \
+                              + std::string( __PRETTY_FUNCTION__ )  \
+                              + std::string( ": Assert failed: " )  \
+                              + std::string( #condition )           \
+    );                                                              \
+  }                                                                 \
+}
+
+#define TRACE_PATH "/tmp/IpcTraceTest.json"
+#define CLIENT_MESSAGE "Hello server"
+#define SERVER_MESSAGE "Hi client"
+#define PLAIN_MESSAGE "Untraced message"
+#define BUF_SIZE 20
+#define ROUNDS 48
+#define SAMPLE_EVERY 4
+#define OVERSIZED_SIZE 40
+// Payload that starts with the header magic but isn't a header
+#define MAGIC_MESSAGE "IPCTRACE and enough bytes to fill a whole header"
+
+int main(int, char **)
+{
+    int pid;
+
+    Ipc::TraceOptions options;
+    options.sampleEvery = SAMPLE_EVERY;
+    Ipc::Trace::enable(options);
+
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        ASSERT_THROW(false);
+    }
+    else if (pid > 0) {
+        // Parent process
+        Ipc::Server server;
+        server.init("IpcTraceTest");
+
+        Ipc::Connection connection = server.accept();
+        ASSERT_THROW(!connection.isInvalid());
+
+        char buffer[BUF_SIZE];
+        size_t bytesReceived = 0;
+        for (int i = 0; i < ROUNDS; i++) {
+            ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+            ASSERT_THROW(bytesReceived == (strlen(CLIENT_MESSAGE) + 1));
+            ASSERT_THROW(strncmp(buffer, CLIENT_MESSAGE, BUF_SIZE) == 0);
+
+            size_t bytesSent = 0;
+            ASSERT_THROW(connection.send(SERVER_MESSAGE, strlen(SERVER_MESSAGE) + 1, &bytesSent));
+            ASSERT_THROW(bytesSent == (strlen(SERVER_MESSAGE) + 1));
+        }
+
+        // Answering samples doesn't start any; a responder that did would
+        // turn the client's next request into a reply
+        for (int stage = 0; stage < Ipc::Trace::StageCount; stage++)
+            ASSERT_THROW(Ipc::Trace::getHistogram((Ipc::Trace::Stage)stage).count == 0);
+
+        // A peer that doesn't trace still gets through intact, and none of
+        // the queued messages is taken to carry a header
+        std::this_thread::sleep_for(100ms);
+        size_t bytesAvailable = 0;
+        ASSERT_THROW(connection.peek(buffer, BUF_SIZE, &bytesReceived, &bytesAvailable));
+        ASSERT_THROW(bytesReceived == (strlen(PLAIN_MESSAGE) + 1));
+        ASSERT_THROW(bytesAvailable == 3 * (strlen(PLAIN_MESSAGE) + 1) +
+                                       OVERSIZED_SIZE + strlen(MAGIC_MESSAGE) + 1);
+        for (int i = 0; i < 2; i++) {
+            ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+            std::cout << "Server: Received " << buffer << std::endl;
+            ASSERT_THROW(bytesReceived == (strlen(PLAIN_MESSAGE) + 1));
+            ASSERT_THROW(strncmp(buffer, PLAIN_MESSAGE, BUF_SIZE) == 0);
+        }
+
+        // Unsampled messages of a tracing peer carry no header
+        Ipc::Trace::disable();
+        ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+        ASSERT_THROW(bytesReceived == (strlen(PLAIN_MESSAGE) + 1));
+        ASSERT_THROW(strncmp(buffer, PLAIN_MESSAGE, BUF_SIZE) == 0);
+
+        // A message that is too long is reported whether or not the
+        // receiver traces, and raw payloads resembling a header arrive whole
+        Ipc::Trace::enable(options);
+        ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+        ASSERT_THROW(bytesReceived == BUF_SIZE);
+        ASSERT_THROW(connection.isTruncated());
+
+        char magicBuffer[2 * sizeof(MAGIC_MESSAGE)];
+        ASSERT_THROW(connection.recv(magicBuffer, sizeof(magicBuffer), &bytesReceived));
+        ASSERT_THROW(bytesReceived == strlen(MAGIC_MESSAGE) + 1);
+        ASSERT_THROW(strcmp(magicBuffer, MAGIC_MESSAGE) == 0);
+        ASSERT_THROW(!connection.isTruncated());
+
+        int status = 0;
+        int waitedpid = wait(&status);
+        ASSERT_THROW(waitedpid == pid);
+        ASSERT_THROW(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    else {
+        // Child process
+        std::this_thread::sleep_for(100ms);
+
+        Ipc::Client client("IpcTraceTest");
+        Ipc::Connection connection = client.connect();
+        ASSERT_THROW(!connection.isInvalid());
+
+        char buffer[BUF_SIZE];
+        size_t bytesReceived = 0;
+        for (int i = 0; i < ROUNDS; i++) {
+            ASSERT_THROW(connection.send(CLIENT_MESSAGE, strlen(CLIENT_MESSAGE) + 1));
+            ASSERT_THROW(connection.recv(buffer, BUF_SIZE, &bytesReceived));
+            ASSERT_THROW(bytesReceived == (strlen(SERVER_MESSAGE) + 1));
+            ASSERT_THROW(strncmp(buffer, SERVER_MESSAGE, BUF_SIZE) == 0);
+        }
+
+        for (int stage = 0; stage < Ipc::Trace::StageCount; stage++) {
+            Ipc::Trace::Stage s = (Ipc::Trace::Stage)stage;
+            Ipc::Trace::Histogram histogram = Ipc::Trace::getHistogram(s);
+
+            std::cout
+                << "Client: " << Ipc::Trace::getStageName(s)
+                << " p50 " << Ipc::Trace::getPercentile(s, 0.5)
+                << " ns, max " << histogram.maxNs << " ns" << std::endl;
+
+            ASSERT_THROW(histogram.count == ROUNDS / SAMPLE_EVERY);
+        }
+
+        Ipc::Trace::Histogram roundTrip = Ipc::Trace::getHistogram(Ipc::Trace::RoundTrip);
+        ASSERT_THROW(roundTrip.totalNs > 0);
+        ASSERT_THROW(Ipc::Trace::getPercentile(Ipc::Trace::RoundTrip, 0.5) <= roundTrip.maxNs);
+
+        ASSERT_THROW(Ipc::Trace::writeChromeTrace(TRACE_PATH));
+        std::ifstream trace(TRACE_PATH);
+        std::string json((std::istreambuf_iterator<char>(trace)),
+                         std::istreambuf_iterator<char>());
+        ASSERT_THROW(json.find("\"traceEvents\"") != std::string::npos);
+        ASSERT_THROW(json.find("\"round trip\"") != std::string::npos);
+        remove(TRACE_PATH);
+
+        Ipc::Trace::disable();
+        ASSERT_THROW(connection.send(PLAIN_MESSAGE, strlen(PLAIN_MESSAGE) + 1));
+        ASSERT_THROW(connection.send(PLAIN_MESSAGE, strlen(PLAIN_MESSAGE) + 1));
+
+        // Unsampled from here on
+        Ipc::TraceOptions unsampled;
+        unsampled.sampleEvery = 1u << 30;
+        Ipc::Trace::enable(unsampled);
+        ASSERT_THROW(connection.send(PLAIN_MESSAGE, strlen(PLAIN_MESSAGE) + 1));
+
+        char oversized[OVERSIZED_SIZE];
+        memset(oversized, 'x', sizeof(oversized));
+        ASSERT_THROW(connection.send(oversized, sizeof(oversized)));
+        ASSERT_THROW(connection.send(MAGIC_MESSAGE, strlen(MAGIC_MESSAGE) + 1));
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+};
+#endif
@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Ipc.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSERT_THROW(condition)                                     \
+{                                                                   \
+  if( !( condition ) )                                              \
+  {                                                                 \
+    throw std::runtime_error(   std::string( __FILE__ )             \
+                              + std::string( ":" )                  \
+                              + std::to_string( __LINE__ )          \
+                              + std::string( " in " )               \
+                              + std::string( __PRETTY_FUNCTION__ )  \
+                              + std::string( ": Assert failed: " )  \
+                              + std::string( #condition )           \
+    );                                                              \
+  }                                                                 \
+}
+
+#define MESSAGE_SIZE 512
+#define MAX_MESSAGES 1000
+
+// Queue messages without reading them until a tune() decision comes out
+static void fill(Ipc::Connection &sender, bool (*done)(const Ipc::Connection::Stats &))
+{
+    char message[MESSAGE_SIZE];
+    memset(message, 'x', sizeof(message));
+
+    for (int i = 0; i < MAX_MESSAGES; i++) {
+        ASSERT_THROW(sender.send(message, sizeof(message)));
+        sender.tune();
+        if (done(sender.getStats())) return;
+    }
+    ASSERT_THROW(false);
+}
+
+int main(int, char **)
+{
+    // Only explicit tune() calls make decisions
+    Ipc::BufferTuning tuning;
+    tuning.enabled = true;
+    tuning.sampleInterval = 1000000;
+    Ipc::setBufferTuning(tuning);
+
+    Ipc::Server server;
+    server.init("IpcTuningTest");
+    Ipc::Client client("IpcTuningTest");
+
+    // An idle connection gives its buffer back
+    {
+        Ipc::Connection idle = client.connect();
+        Ipc::Connection peer = server.accept();
+        ASSERT_THROW(!idle.isInvalid() && !peer.isInvalid());
+
+        size_t initial = idle.getStats().sendBufferSize;
+        idle.tune();
+        idle.tune();
+        Ipc::Connection::Stats stats = idle.getStats();
+
+        std::cout
+            << "Idle: " << initial << " -> " << stats.sendBufferSize
+            << " bytes, " << stats.bufferShrinks << " shrinks" << std::endl;
+
+        ASSERT_THROW(stats.bufferShrinks == 2);
+        ASSERT_THROW(stats.sendBufferSize < initial);
+        ASSERT_THROW(stats.sendBufferSize >= tuning.minSize);
+        ASSERT_THROW(Ipc::getBufferMemory() ==
+                     stats.sendBufferSize + peer.getStats().sendBufferSize);
+    }
+    ASSERT_THROW(Ipc::getBufferMemory() == 0);
+
+    // A sender whose peer doesn't keep up gets a bigger buffer
+    tuning.initialSize = 32 * 1024;
+    tuning.minSize = 32 * 1024;
+    Ipc::setBufferTuning(tuning);
+    {
+        Ipc::Connection sender = client.connect();
+        Ipc::Connection peer = server.accept();
+        size_t initial = sender.getStats().sendBufferSize;
+
+        fill(sender, [](const Ipc::Connection::Stats &stats) { return stats.bufferGrows > 0; });
+        Ipc::Connection::Stats stats = sender.getStats();
+
+        std::cout
+            << "Backed up: " << initial << " -> " << stats.sendBufferSize
+            << " bytes, peak queue " << stats.peakSendQueue << std::endl;
+
+        ASSERT_THROW(stats.sendBufferSize > initial);
+        ASSERT_THROW(stats.peakSendQueue >= initial - initial / 4);
+    }
+
+    // A burst the peer drains before the next decision still counts
+    {
+        Ipc::Connection sender = client.connect();
+        Ipc::Connection peer = server.accept();
+        size_t initial = sender.getStats().sendBufferSize;
+
+        char message[MESSAGE_SIZE];
+        memset(message, 'x', sizeof(message));
+        int queued = 0;
+        while (sender.getStats().peakSendQueue < initial - initial / 4) {
+            ASSERT_THROW(queued < MAX_MESSAGES);
+            ASSERT_THROW(sender.send(message, sizeof(message)));
+            queued++;
+        }
+        for (int i = 0; i < queued; i++)
+            ASSERT_THROW(peer.recv(message, sizeof(message)));
+
+        sender.tune();
+        Ipc::Connection::Stats stats = sender.getStats();
+
+        std::cout
+            << "Burst: " << queued << " messages, " << initial << " -> "
+            << stats.sendBufferSize << " bytes" << std::endl;
+
+        ASSERT_THROW(stats.bufferGrows == 1);
+        ASSERT_THROW(stats.sendBufferSize > initial);
+    }
+
+    // Growth beyond the process limit is refused
+    {
+        Ipc::Connection sender = client.connect();
+        Ipc::Connection peer = server.accept();
+        size_t initial = sender.getStats().sendBufferSize;
+
+        tuning.processLimit = Ipc::getBufferMemory();
+        Ipc::setBufferTuning(tuning);
+
+        fill(sender, [](const Ipc::Connection::Stats &stats) { return stats.bufferDenied > 0; });
+        Ipc::Connection::Stats stats = sender.getStats();
+
+        std::cout << "Limited: " << stats.bufferDenied << " grows denied" << std::endl;
+
+        ASSERT_THROW(stats.bufferGrows == 0);
+        ASSERT_THROW(stats.sendBufferSize == initial);
+        ASSERT_THROW(Ipc::getBufferMemory() <= tuning.processLimit);
+    }
+
+    // Once the limit is used up, new connections start small instead of
+    // keeping the kernel default
+    tuning.initialSize = 0;
+    tuning.minSize = 16 * 1024;
+    tuning.processLimit = 64 * 1024;
+    Ipc::setBufferTuning(tuning);
+    ASSERT_THROW(Ipc::getBufferMemory() == 0);
+    {
+        std::vector<Ipc::Connection> connections;
+        for (int i = 0; i < 4; i++) {
+            connections.push_back(client.connect());
+            connections.push_back(server.accept());
+            ASSERT_THROW(!connections.back().isInvalid());
+        }
+
+        size_t total = 0;
+        for (Ipc::Connection &connection : connections) {
+            Ipc::Connection::Stats stats = connection.getStats();
+            total += stats.sendBufferSize;
+            ASSERT_THROW(stats.sendBufferSize <= tuning.processLimit);
+            ASSERT_THROW(stats.bufferDenied == 1);
+        }
+        Ipc::Connection::Stats last = connections.back().getStats();
+
+        std::cout
+            << "Budget: " << connections.size() << " connections, "
+            << Ipc::getBufferMemory() << " bytes, last starts at "
+            << last.sendBufferSize << std::endl;
+
+        ASSERT_THROW(last.sendBufferSize == tuning.minSize);
+        ASSERT_THROW(Ipc::getBufferMemory() == total);
+        ASSERT_THROW(total <= tuning.processLimit + connections.size() * tuning.minSize);
+    }
+    ASSERT_THROW(Ipc::getBufferMemory() == 0);
+
+    return 0;
+}
+
+#ifdef __cplusplus
+};
+#endif